@@ -0,0 +1,291 @@
+#pragma once
+
+#include "fft_engine.h"
+#include "height_map.h"
+#include "parallel.h"
+#include "power_spectrum.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+// Radial bandpass filter over a height map. The forward spectrum of the input is
+// computed once per setInput() and reused, so each apply() only masks a copy of
+// it and runs the inverse transform.
+//
+// The transform grid is padded to the next 2^a*3^b*5^c*7^d size, so any scan size
+// gets FFTW's fast paths, and the result is cropped back. Padding mirrors the
+// edges or fills with the mean; an optional Tukey or Hann window tapers the scan
+// towards its mean first, which reduces leakage from the edges into the spectrum.
+//
+// Without a window, apply() can also average the masked spectrum into a PSD of
+// its output before the inverse transform consumes it, so no extra transform runs.
+class BandpassFilter {
+public:
+    enum Padding { NoPadding = 0, MirrorPadding = 1, MeanPadding = 2 };
+    enum Window { NoWindow = 0, TukeyWindow = 1, HannWindow = 2 };
+
+    // Shares the map's storage; samples are converted straight into the FFT input
+    // plane, so integer maps are never widened into a separate float copy
+    void setInput(const HeightMap& map) {
+        input = map;
+        width = map.width;
+        height = map.height;
+        spectrumValid = false;
+    }
+
+    bool hasInput() const { return !input.empty(); }
+
+    // Plan buffers held for the current input
+    size_t bytes() const { return fft.bytes(); }
+
+    void setPlannerEffort(FftEngine::PlannerEffort e) {
+        fft.setPlannerEffort(e);
+        spectrumValid = false;
+    }
+
+    FftEngine::PlannerEffort plannerEffort() const { return fft.plannerEffort(); }
+
+    // tukeyAlpha is the tapered fraction of the Tukey window (split between both edges)
+    void setEdgeHandling(Padding p, Window w, float tukeyAlpha = 0.25f) {
+        padding = p;
+        window = w;
+        alpha = std::max(0.0f, std::min(tukeyAlpha, 1.0f));
+        spectrumValid = false;
+    }
+
+    Padding edgePadding() const { return padding; }
+    Window edgeWindow() const { return window; }
+
+    // Rings of the PSD taken by apply(); 0 (the default) skips it. A windowed
+    // spectrum is not that of the output, so no PSD is taken with a window.
+    void setSpectrumBins(size_t bins) { spectrumBins = bins; }
+
+    // PSD of the last apply() output over the padded grid, or empty
+    const PowerSpectrum& outputSpectrum() const { return psd; }
+
+    // Filters the input into output (width*height values) keeping spatial frequencies
+    // between the two cutoffs. Returns false if the FFT could not be set up or
+    // cancelled() returned true between stages.
+    bool apply(float lowCutoff, float highCutoff, float* output, float& zMinOut, float& zMaxOut,
+               const std::function<bool()>& cancelled = nullptr, std::atomic<float>* progress = nullptr) {
+        auto report = [&](float p) { if (progress) progress->store(p); };
+        auto stop = [&]() { return cancelled && cancelled(); };
+        psd = PowerSpectrum();
+        if (!hasInput()) return false;
+
+        report(0.0f);
+        if (!updateSpectrum()) return false;
+        if (stop()) return false;
+        report(0.3f);
+
+        int64_t maskStart = Profiler::nowUs();
+        fftwf_complex* spectrum = fft.work();
+        std::memcpy(spectrum, fft.spectrum(), sizeof(fftwf_complex) * fft.spectrumSize());
+
+        // Use spatial frequency based on physical size
+        float pixelSize = 10.0f / std::max(width, height);  // Assuming 10 units across the image
+        float filterLowFreq = lowCutoff / (pixelSize * 1e6f);  // Convert μm to cycles/unit
+        float filterHighFreq = highCutoff / (pixelSize * 1e6f);  // Convert μm to cycles/unit
+        if (filterLowFreq > filterHighFreq) std::swap(filterLowFreq, filterHighFreq);
+
+        float nyquist = 0.5f;  // Nyquist frequency (max freq = 0.5 cycles/pixel)
+        float lowCutoffFreq = filterLowFreq * pixelSize;  // Scale to normalized frequency
+        float highCutoffFreq = filterHighFreq * pixelSize;
+        lowCutoffFreq = std::max(0.0f, std::min(lowCutoffFreq, nyquist));
+        highCutoffFreq = std::max(0.0f, std::min(highCutoffFreq, nyquist));
+
+        // Half spectrum from the r2c transform: only non-negative x frequencies are stored.
+        // Frequencies are in cycles per pixel of the padded grid.
+        uint32_t gridWidth = fft.gridWidth(), gridHeight = fft.gridHeight();
+        uint32_t spectrumWidth = fft.spectrumWidth();
+        for (uint32_t y = 0; y < gridHeight; y++) {
+            float fy = (y < gridHeight/2 ? y : (float)y - gridHeight) / (float)gridHeight;
+            for (uint32_t x = 0; x < spectrumWidth; x++) {
+                size_t idx = (size_t)y * spectrumWidth + x;
+                float fx = x / (float)gridWidth;
+                float freq = sqrt(fx * fx + fy * fy);
+                if (freq < lowCutoffFreq || freq > highCutoffFreq) {
+                    spectrum[idx][0] = 0.0f;
+                    spectrum[idx][1] = 0.0f;
+                }
+            }
+        }
+        Profiler::instance().record("FFT mask", maskStart, Profiler::nowUs() - maskStart);
+        if (stop()) return false;
+        if (spectrumBins > 0 && window == NoWindow) psd = PowerSpectrum::radial(spectrum, gridWidth, gridHeight, spectrumBins);
+        report(0.5f);
+
+        {
+            ScopedTimer timer("FFT inverse");
+            fft.inverse();
+        }
+        if (stop()) return false;
+        report(0.9f);
+
+        ScopedTimer timer("FFT output");
+        // Crop the padded grid back to the scan; samples that were invalid in the
+        // input are invalid in the output again
+        const float* filtered = fft.real();
+        float norm = 1.0f / (static_cast<float>(gridWidth) * gridHeight);
+        float zMinVal = std::numeric_limits<float>::max();
+        float zMaxVal = std::numeric_limits<float>::lowest();
+        std::vector<float> scratch(hasInvalid ? width : 0);
+        for (uint32_t y = 0; y < height; y++) {
+            const float* src = filtered + static_cast<size_t>(y) * gridWidth;
+            const float* in = hasInvalid ? input.row(y, scratch.data()) : nullptr;
+            float* dst = output + static_cast<size_t>(y) * width;
+            for (uint32_t x = 0; x < width; x++) {
+                if (in && !std::isfinite(in[x])) {
+                    dst[x] = in[x];
+                    continue;
+                }
+                float z = src[x] * norm;
+                z = std::max(-FLT_MAX/2.0f, std::min(z, FLT_MAX/2.0f));  // Clamp to prevent overflow
+                dst[x] = z;
+                zMinVal = std::min(zMinVal, z);
+                zMaxVal = std::max(zMaxVal, z);
+            }
+        }
+        if (zMinVal > zMaxVal) zMinVal = zMaxVal = 0.0f;  // No finite sample
+        zMinOut = zMinVal;
+        zMaxOut = zMaxVal;
+        report(1.0f);
+        return true;
+    }
+
+private:
+    FftEngine fft;
+    HeightMap input;
+    uint32_t width = 0, height = 0;
+    bool spectrumValid = false;
+    bool hasInvalid = false;  // The input has non-finite samples
+    Padding padding = MirrorPadding;
+    Window window = NoWindow;
+    float alpha = 0.25f;
+    size_t spectrumBins = 0;
+    PowerSpectrum psd;
+
+    bool updateSpectrum() {
+        if (spectrumValid) return true;
+
+        // Plans and buffers are only recreated when the size or planner effort changes
+        uint32_t gridWidth = padding == NoPadding ? width : FftEngine::goodSize(width);
+        uint32_t gridHeight = padding == NoPadding ? height : FftEngine::goodSize(height);
+        {
+            ScopedTimer timer("FFT plan");
+            if (!fft.prepare(gridWidth, gridHeight)) return false;
+        }
+
+        ScopedTimer timer("FFT forward");
+        fillGrid();
+        fft.forward();
+        spectrumValid = true;
+        return true;
+    }
+
+    // Copies the input into the top left of the transform grid, replaces invalid
+    // samples with the mean, applies the window and fills the padding. A single
+    // NaN would otherwise spread over the whole spectrum.
+    void fillGrid() {
+        float* grid = fft.real();
+        uint32_t gridWidth = fft.gridWidth(), gridHeight = fft.gridHeight();
+        size_t rowChunks = chunkCount(height, 16);
+        parallelFor(height, rowChunks, [&](size_t, size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) input.copyTo(y * width, width, grid + y * gridWidth);
+        });
+
+        size_t invalid = 0;
+        float mean = finiteMean(grid, gridWidth, invalid);
+        hasInvalid = invalid > 0;
+        if (hasInvalid) {
+            parallelFor(height, rowChunks, [&](size_t, size_t begin, size_t end) {
+                for (size_t y = begin; y < end; y++) {
+                    float* row = grid + y * gridWidth;
+                    for (uint32_t x = 0; x < width; x++) row[x] = std::isfinite(row[x]) ? row[x] : mean;
+                }
+            });
+        }
+        if (window != NoWindow) {
+            std::vector<float> wx = windowWeights(width), wy = windowWeights(height);
+            parallelFor(height, rowChunks, [&](size_t, size_t begin, size_t end) {
+                for (size_t y = begin; y < end; y++) {
+                    float* row = grid + y * gridWidth;
+                    for (uint32_t x = 0; x < width; x++) row[x] = mean + (row[x] - mean) * wx[x] * wy[y];
+                }
+            });
+        }
+
+        if (gridWidth > width) {
+            parallelFor(height, rowChunks, [&](size_t, size_t begin, size_t end) {
+                for (size_t y = begin; y < end; y++) {
+                    float* row = grid + y * gridWidth;
+                    for (uint32_t x = width; x < gridWidth; x++) {
+                        row[x] = padding == MeanPadding ? mean : row[mirrorIndex(x, width, gridWidth)];
+                    }
+                }
+            });
+        }
+        for (uint32_t y = height; y < gridHeight; y++) {
+            float* row = grid + static_cast<size_t>(y) * gridWidth;
+            if (padding == MeanPadding) {
+                std::fill(row, row + gridWidth, mean);
+            } else {
+                std::memcpy(row, grid + static_cast<size_t>(mirrorIndex(y, height, gridHeight)) * gridWidth,
+                            gridWidth * sizeof(float));
+            }
+        }
+    }
+
+    // Source of padded position i (n <= i < padded). The first half of the padding
+    // mirrors the far edge and the second half the near edge, so the grid stays
+    // continuous where the transform wraps around.
+    static uint32_t mirrorIndex(uint32_t i, uint32_t n, uint32_t padded) {
+        uint32_t pad = padded - n, d = i - n;
+        int64_t src = d < (pad + 1) / 2 ? static_cast<int64_t>(n) - 1 - d : static_cast<int64_t>(padded) - 1 - i;
+        return static_cast<uint32_t>(std::max<int64_t>(0, std::min<int64_t>(src, n - 1)));
+    }
+
+    // Mean of the finite samples in the scan part of the grid; the others are counted in invalid
+    float finiteMean(const float* grid, uint32_t gridWidth, size_t& invalid) const {
+        size_t chunks = chunkCount(static_cast<size_t>(width) * height);
+        std::vector<double> sums(chunks, 0.0);
+        std::vector<size_t> counts(chunks, 0);
+        parallelFor(height, chunks, [&](size_t chunk, size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                const float* row = grid + y * gridWidth;
+                for (uint32_t x = 0; x < width; x++) {
+                    if (!std::isfinite(row[x])) continue;
+                    sums[chunk] += row[x];
+                    counts[chunk]++;
+                }
+            }
+        });
+        double sum = 0.0;
+        size_t count = 0;
+        for (size_t c = 0; c < chunks; c++) {
+            sum += sums[c];
+            count += counts[c];
+        }
+        invalid = static_cast<size_t>(width) * height - count;
+        return count > 0 ? static_cast<float>(sum / count) : 0.0f;
+    }
+
+    // Window weights over n samples; Hann is a Tukey window tapered over its whole length
+    std::vector<float> windowWeights(uint32_t n) const {
+        std::vector<float> weights(n, 1.0f);
+        float taper = window == HannWindow ? 1.0f : alpha;
+        if (n < 2 || taper <= 0.0f) return weights;
+        const float pi = 3.14159265358979f;
+        for (uint32_t i = 0; i < n; i++) {
+            float t = static_cast<float>(i) / (n - 1);
+            float edge = std::min(t, 1.0f - t);  // Distance to the nearer edge, 0..0.5
+            if (edge < taper / 2.0f) weights[i] = 0.5f * (1.0f - std::cos(2.0f * pi * edge / taper));
+        }
+        return weights;
+    }
+};
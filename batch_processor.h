@@ -0,0 +1,311 @@
+#pragma once
+
+#include "fft_engine.h"
+#include "filter_pipeline.h"
+#include "parallel.h"
+#include "surface_stats.h"
+#include "tiff_decoder.h"
+#include "tiff_writer.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct BatchSettings {
+    std::string inputFolder;
+    std::string outputFolder;       // Defaults to <input>/filtered
+    bool bandLimits = false;        // Without explicit limits each file uses its raw Z range, like the viewer
+    float lowCutoff = 0.0f, highCutoff = 0.0f;  // Bandpass cutoffs in micrometers
+    std::vector<FilterStage> stages;  // Run in order before the bandpass
+    unsigned threads = 0;           // Files processed at once; 0 picks from the core count
+    size_t memoryBudget = size_t(4) << 30;  // Estimated bytes of all files in flight
+    bool nativePrecision = false;
+    FftEngine::PlannerEffort plannerEffort = FftEngine::Estimate;
+    BandpassFilter::Padding padding = BandpassFilter::MirrorPadding;
+    BandpassFilter::Window window = BandpassFilter::NoWindow;
+    bool writeMaps = true;
+    size_t spectrumBins = 0;        // Rings of the <name>_psd.csv written per file; 0 writes none
+    uint16_t compression = COMPRESSION_NONE;
+};
+
+struct BatchResult {
+    std::string name;
+    bool ok = false;
+    std::string error;
+    uint32_t width = 0, height = 0;
+    SurfaceStats raw, filtered;
+    double decodeMs = 0.0, filterMs = 0.0, writeMs = 0.0;
+};
+
+// Runs the viewer's load -> filter pipeline -> statistics sequence over every TIFF in a
+// folder without a window or GL context.
+//
+// Files are processed concurrently on a ThreadPool. Before a file starts, its
+// working set is estimated from the TIFF header and reserved against the memory
+// budget, so large scans wait for memory instead of all decoding at once; a
+// single file larger than the budget still runs once nothing else is in flight.
+// FFTW threads are divided between the concurrent files.
+class BatchProcessor {
+public:
+    explicit BatchProcessor(const BatchSettings& s) : settings(s) {
+        if (settings.outputFolder.empty()) settings.outputFolder = settings.inputFolder + "/filtered";
+    }
+
+    // Processes the folder and writes summary.csv to the output folder. Returns
+    // false if the folder could not be read or the summary not written; per-file
+    // failures are reported in results().
+    bool run(std::string& error) {
+        std::vector<std::string> files;
+        if (!listTiffFiles(settings.inputFolder, files, error)) return false;
+        if (mkdir(settings.outputFolder.c_str(), 0755) != 0 && errno != EEXIST) {
+            error = "Failed to create output folder: " + settings.outputFolder;
+            return false;
+        }
+
+        unsigned threads = settings.threads > 0 ? settings.threads : std::max(1u, hardwareThreads() / 4);
+        threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(1, files.size())));
+        FftEngine::setThreads(static_cast<int>(std::max(1u, hardwareThreads() / threads)));
+
+        // Freed FFT buffers are kept for the next file of the same size, out of the budget
+        size_t poolBytes = settings.memoryBudget / 4;
+        FftBufferPool::setLimit(poolBytes);
+        available = settings.memoryBudget - poolBytes;
+        reserved = 0;
+        inFlight = 0;
+
+        resultList.assign(files.size(), BatchResult());
+        done = 0;
+        auto startTime = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool(threads);
+            pool.run(files.size(), [&](size_t i) { processFile(files[i], resultList[i], files.size()); });
+        }
+        FftBufferPool::trim();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        return writeSummary(error);
+    }
+
+    const std::vector<BatchResult>& results() const { return resultList; }
+
+    size_t failures() const {
+        return static_cast<size_t>(std::count_if(resultList.begin(), resultList.end(),
+                                                 [](const BatchResult& r) { return !r.ok; }));
+    }
+
+    double elapsedSeconds() const { return seconds; }
+
+    // Output path of the filtered map for an input file name
+    std::string outputPath(const std::string& name) const {
+        size_t dot = name.find_last_of('.');
+        return settings.outputFolder + "/" + name.substr(0, dot) + "_filtered.tif";
+    }
+
+    std::string spectrumPath(const std::string& name) const {
+        size_t dot = name.find_last_of('.');
+        return settings.outputFolder + "/" + name.substr(0, dot) + "_psd.csv";
+    }
+
+private:
+    BatchSettings settings;
+    std::vector<BatchResult> resultList;
+    std::mutex mutex;
+    std::condition_variable memoryFreed;
+    size_t available = 0, reserved = 0, inFlight = 0;
+    size_t done = 0;
+    double seconds = 0.0;
+
+    static bool listTiffFiles(const std::string& folder, std::vector<std::string>& files, std::string& error) {
+        DIR* dir = opendir(folder.c_str());
+        if (!dir) {
+            error = "Failed to open directory: " + folder;
+            return false;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string filename = entry->d_name;
+            if (filename.length() > 4 &&
+                (strcmp(filename.c_str() + filename.length() - 4, ".tif") == 0 ||
+                 strcmp(filename.c_str() + filename.length() - 5, ".tiff") == 0)) {
+                files.push_back(filename);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+        return true;
+    }
+
+    // Decoded map, outputs of the stages before the bandpass, padded FFT plane,
+    // spectrum and work buffers, the filtered output, and the PSD transform's
+    // buffers when one is written with a window (without one the bandpass takes
+    // the PSD from its masked spectrum)
+    size_t estimatedBytes(const TiffInfo& info) const {
+        bool integer = info.sampleFormat == SAMPLEFORMAT_UINT && info.bitsPerSample <= 16;
+        size_t sampleSize = settings.nativePrecision && integer ? info.bitsPerSample / 8 : sizeof(float);
+        size_t samples = static_cast<size_t>(info.width) * info.height;
+        bool padded = settings.padding != BandpassFilter::NoPadding;
+        size_t gridWidth = padded ? FftEngine::goodSize(info.width) : info.width;
+        size_t gridHeight = padded ? FftEngine::goodSize(info.height) : info.height;
+        size_t spectrum = (gridWidth / 2 + 1) * gridHeight;
+        size_t psd = 0;
+        if (settings.spectrumBins > 0 && settings.window != BandpassFilter::NoWindow) {
+            size_t psdWidth = FftEngine::goodSize(info.width), psdHeight = FftEngine::goodSize(info.height);
+            psd = psdWidth * psdHeight * sizeof(float) + 2 * (psdWidth / 2 + 1) * psdHeight * sizeof(fftwf_complex);
+        }
+        return samples * (sampleSize + sizeof(float)) + FilterPipeline::outputBytes(settings.stages, samples) + gridWidth * gridHeight * sizeof(float) +
+               2 * spectrum * sizeof(fftwf_complex) + psd;
+    }
+
+    void acquireMemory(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        memoryFreed.wait(lock, [&] { return inFlight == 0 || reserved + bytes <= available; });
+        reserved += bytes;
+        inFlight++;
+    }
+
+    void releaseMemory(size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reserved -= bytes;
+            inFlight--;
+        }
+        memoryFreed.notify_all();
+    }
+
+    void processFile(const std::string& name, BatchResult& result, size_t total) {
+        using Clock = std::chrono::steady_clock;
+        auto ms = [](Clock::time_point since) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+        };
+        result.name = name;
+        std::string path = settings.inputFolder + "/" + name;
+        TiffInfo info;
+        if (!TiffDecoder::readInfo(path, info, result.error)) {
+            report(result, total);
+            return;
+        }
+        size_t bytes = estimatedBytes(info);
+        acquireMemory(bytes);
+
+        auto stageStart = Clock::now();
+        HeightMap map;
+        SampleStats sampleStats;
+        if (TiffDecoder::decode(path, map, info, sampleStats, result.error, settings.nativePrecision)) {
+            result.decodeMs = ms(stageStart);
+            result.width = map.width;
+            result.height = map.height;
+            result.raw = SurfaceStats::compute(map);
+
+            stageStart = Clock::now();
+            std::vector<FilterStage> stages = settings.stages;
+            FilterStage bandpass;
+            bandpass.low = settings.bandLimits ? settings.lowCutoff : sampleStats.min;
+            bandpass.high = settings.bandLimits ? settings.highCutoff : sampleStats.max;
+            stages.push_back(bandpass);
+            FilterPipeline pipeline;
+            pipeline.setPlannerEffort(settings.plannerEffort);
+            pipeline.setEdgeHandling(settings.padding, settings.window);
+            pipeline.setSpectrumBins(settings.spectrumBins);
+            pipeline.setInput(map);
+            pipeline.setStages(stages);
+            result.ok = pipeline.run();
+            if (!result.ok) {
+                result.error = "FFT setup failed";
+            } else {
+                result.filterMs = ms(stageStart);
+                HeightMap filtered = pipeline.output();
+                result.filtered = pipeline.outputStats();
+                stageStart = Clock::now();
+                if (settings.writeMaps) {
+                    result.ok = TiffWriter::write(outputPath(name), filtered, result.error, settings.compression);
+                }
+                PowerSpectrum spectrum;
+                if (result.ok && settings.spectrumBins > 0) {
+                    if (pipeline.outputSpectrum(spectrum)) {
+                        result.ok = writeSpectrum(spectrumPath(name), spectrum, result.error);
+                    }
+                }
+                result.writeMs = ms(stageStart);
+            }
+        }
+        releaseMemory(bytes);
+        report(result, total);
+    }
+
+    void report(const BatchResult& result, size_t total) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done++;
+        std::cout << "[" << done << "/" << total << "] " << result.name;
+        if (result.ok) {
+            std::cout << ": " << result.width << "x" << result.height << ", decode " << result.decodeMs
+                      << " ms, filter " << result.filterMs << " ms, write " << result.writeMs << " ms" << std::endl;
+        } else {
+            std::cout << ": FAILED - " << result.error << std::endl;
+        }
+    }
+
+    static std::string quoted(const std::string& text) {
+        std::string result = "\"";
+        for (char c : text) result += c == '"' ? std::string("\"\"") : std::string(1, c);
+        return result + "\"";
+    }
+
+    static bool writeSpectrum(const std::string& path, const PowerSpectrum& spectrum, std::string& error) {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            error = "Failed to create " + path;
+            return false;
+        }
+        out.precision(9);
+        out << "frequency,power\n";
+        for (size_t i = 0; i < spectrum.power.size(); i++) out << spectrum.frequency[i] << "," << spectrum.power[i] << "\n";
+        out.close();
+        if (!out) {
+            error = "Failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    static void writeRoughness(std::ostream& out, const SurfaceStats& s) {
+        out << s.sa << "," << s.sq << "," << s.sp << "," << s.sv << "," << s.sz << "," << s.ssk << "," << s.sku << ",";
+    }
+
+    bool writeSummary(std::string& error) const {
+        std::string path = settings.outputFolder + "/summary.csv";
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            error = "Failed to create " + path;
+            return false;
+        }
+        out.precision(9);
+        out << "file,status,width,height,invalid,"
+               "raw_min,raw_max,raw_mean,raw_std,"
+               "filtered_min,filtered_max,filtered_mean,filtered_std,"
+               "raw_sa,raw_sq,raw_sp,raw_sv,raw_sz,raw_ssk,raw_sku,"
+               "filtered_sa,filtered_sq,filtered_sp,filtered_sv,filtered_sz,filtered_ssk,filtered_sku,"
+               "decode_ms,filter_ms,write_ms,error\n";
+        for (const BatchResult& r : resultList) {
+            out << quoted(r.name) << "," << (r.ok ? "ok" : "failed") << "," << r.width << "," << r.height << ","
+                << r.raw.invalid << "," << r.raw.min << "," << r.raw.max << "," << r.raw.mean << "," << r.raw.stdDev
+                << "," << r.filtered.min << "," << r.filtered.max << "," << r.filtered.mean << ","
+                << r.filtered.stdDev << ",";
+            writeRoughness(out, r.raw);
+            writeRoughness(out, r.filtered);
+            out << r.decodeMs << "," << r.filterMs << "," << r.writeMs << "," << quoted(r.error) << "\n";
+        }
+        out.close();
+        if (!out) {
+            error = "Failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+
+// Orbit camera shared by the viewer and the offscreen renderer. The surface
+// spans -5..5 in X and Y; the camera looks at it from distance zoom after
+// rotating it about X, then Y (degrees), and shifting it by the pan offsets.
+struct Camera {
+    float zoom = 5.0f;
+    float rotX = 0.0f, rotY = 0.0f;
+    float panX = 0.0f, panY = 0.0f;
+
+    glm::mat4 projection(float aspect) const {
+        return glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+    }
+
+    glm::mat4 view() const {
+        glm::mat4 v = glm::translate(glm::mat4(1.0f), glm::vec3(panX, panY, -zoom));
+        v = glm::rotate(v, glm::radians(rotX), glm::vec3(1, 0, 0));
+        return glm::rotate(v, glm::radians(rotY), glm::vec3(0, 1, 0));
+    }
+
+    // Screen pixels the 10 unit wide surface covers at this zoom, used to pick the LOD level
+    float surfacePixels(int viewportHeight) const {
+        // A 45 degree frustum at distance zoom shows 2*zoom*tan(22.5) units
+        float visibleUnits = 2.0f * zoom * std::tan(glm::radians(22.5f));
+        return viewportHeight * 10.0f / visibleUnits;
+    }
+
+    // World-space ray through a point in normalized device coordinates (-1..1, Y up)
+    void ray(float ndcX, float ndcY, float aspect, glm::vec3& origin, glm::vec3& direction) const {
+        glm::mat4 inverse = glm::inverse(projection(aspect) * view());
+        glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+        glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+        origin = glm::vec3(nearPoint.x, nearPoint.y, nearPoint.z) / nearPoint.w;
+        glm::vec3 end = glm::vec3(farPoint.x, farPoint.y, farPoint.z) / farPoint.w;
+        direction = glm::normalize(end - origin);
+    }
+
+    static Camera lerp(const Camera& a, const Camera& b, float t) {
+        Camera c;
+        c.zoom = a.zoom + (b.zoom - a.zoom) * t;
+        c.rotX = a.rotX + (b.rotX - a.rotX) * t;
+        c.rotY = a.rotY + (b.rotY - a.rotY) * t;
+        c.panX = a.panX + (b.panX - a.panX) * t;
+        c.panY = a.panY + (b.panY - a.panY) * t;
+        return c;
+    }
+};
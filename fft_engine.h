@@ -0,0 +1,260 @@
+#pragma once
+
+#include <fftw3.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Recycles FFTW-aligned buffers by size, so re-planning or switching between scans
+// of the same size reuses memory instead of returning it to the OS and faulting it
+// back in. At most the limit set by setLimit() (1 GiB by default) stays cached.
+class FftBufferPool {
+public:
+    static void* acquire(size_t bytes) {
+        State& s = state();
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.free.find(bytes);
+            if (it != s.free.end()) {
+                void* buffer = it->second;
+                s.free.erase(it);
+                s.cached -= bytes;
+                return buffer;
+            }
+        }
+        return fftwf_malloc(bytes);
+    }
+
+    static void release(void* buffer, size_t bytes) {
+        if (!buffer) return;
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (bytes > s.limit) {
+            fftwf_free(buffer);
+            return;
+        }
+        // Evict the largest cached buffers until the new one fits
+        while (s.cached + bytes > s.limit && !s.free.empty()) {
+            auto largest = std::prev(s.free.end());
+            fftwf_free(largest->second);
+            s.cached -= largest->first;
+            s.free.erase(largest);
+        }
+        s.free.emplace(bytes, buffer);
+        s.cached += bytes;
+    }
+
+    static void setLimit(size_t bytes) {
+        State& s = state();
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.limit = bytes;
+        }
+        trim();
+    }
+
+    // Frees cached buffers beyond the limit
+    static void trim() {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        while (s.cached > s.limit && !s.free.empty()) {
+            auto largest = std::prev(s.free.end());
+            fftwf_free(largest->second);
+            s.cached -= largest->first;
+            s.free.erase(largest);
+        }
+    }
+
+    static size_t cachedBytes() {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.cached;
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::multimap<size_t, void*> free;
+        size_t cached = 0;
+        size_t limit = size_t(1) << 30;
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+};
+
+// Single-precision real-to-complex FFT engine for height maps.
+//
+// Owns the real input/output plane, the cached forward spectrum and a work copy
+// of the spectrum that the inverse transform consumes. Plans use FFTW's threaded
+// planner on all cores; with MEASURE/PATIENT effort the resulting wisdom is
+// persisted to disk so expensive planning only happens once per size per machine.
+class FftEngine {
+public:
+    enum PlannerEffort { Estimate = 0, Measure = 1, Patient = 2 };
+
+    FftEngine() { initializeFftw(); }
+
+    ~FftEngine() { release(); }
+
+    FftEngine(const FftEngine&) = delete;
+    FftEngine& operator=(const FftEngine&) = delete;
+
+    // Allocates buffers and creates plans for a width x height real grid. Does
+    // nothing if the size and planner effort are unchanged. Planning may
+    // overwrite the buffers, so fill real() only after this returns.
+    bool prepare(uint32_t w, uint32_t h) {
+        if (w == width && h == height && plannedEffort == effort && forwardPlan && inversePlan) {
+            return true;
+        }
+        release();
+        if (w == 0 || h == 0) return false;
+
+        // Set first so release() returns the buffers with their sizes on failure
+        width = w;
+        height = h;
+        size_t realCount = static_cast<size_t>(w) * h;
+        size_t complexCount = spectrumSize();
+        realData = static_cast<float*>(FftBufferPool::acquire(realCount * sizeof(float)));
+        spectrumData = static_cast<fftwf_complex*>(FftBufferPool::acquire(complexCount * sizeof(fftwf_complex)));
+        workData = static_cast<fftwf_complex*>(FftBufferPool::acquire(complexCount * sizeof(fftwf_complex)));
+        if (!realData || !spectrumData || !workData) {
+            std::cerr << "Failed to allocate FFT buffers for " << w << "x" << h << std::endl;
+            release();
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(plannerMutex());
+            unsigned flags = plannerFlags(effort);
+            forwardPlan = fftwf_plan_dft_r2c_2d(h, w, realData, spectrumData, flags);
+            inversePlan = fftwf_plan_dft_c2r_2d(h, w, workData, realData, flags | FFTW_DESTROY_INPUT);
+            if (effort != Estimate && forwardPlan && inversePlan) {
+                if (!fftwf_export_wisdom_to_filename(wisdomPath().c_str())) {
+                    std::cerr << "Failed to save FFTW wisdom to " << wisdomPath() << std::endl;
+                }
+            }
+        }
+        if (!forwardPlan || !inversePlan) {
+            std::cerr << "Failed to create FFT plans for " << w << "x" << h << std::endl;
+            release();
+            return false;
+        }
+
+        plannedEffort = effort;
+        return true;
+    }
+
+    // Destroys the plans and hands the buffers back to FftBufferPool
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(plannerMutex());
+            if (forwardPlan) fftwf_destroy_plan(forwardPlan);
+            if (inversePlan) fftwf_destroy_plan(inversePlan);
+        }
+        size_t complexBytes = spectrumSize() * sizeof(fftwf_complex);
+        FftBufferPool::release(realData, static_cast<size_t>(width) * height * sizeof(float));
+        FftBufferPool::release(spectrumData, complexBytes);
+        FftBufferPool::release(workData, complexBytes);
+        forwardPlan = inversePlan = nullptr;
+        realData = nullptr;
+        spectrumData = workData = nullptr;
+        width = height = 0;
+    }
+
+    // Changing the effort takes effect at the next prepare()
+    void setPlannerEffort(PlannerEffort e) { effort = e; }
+    PlannerEffort plannerEffort() const { return effort; }
+
+    // Bytes held by the plan buffers
+    size_t bytes() const {
+        return static_cast<size_t>(width) * height * sizeof(float) + 2 * spectrumSize() * sizeof(fftwf_complex);
+    }
+
+    uint32_t gridWidth() const { return width; }
+    uint32_t gridHeight() const { return height; }
+    uint32_t spectrumWidth() const { return width / 2 + 1; }
+    size_t spectrumSize() const { return static_cast<size_t>(height) * spectrumWidth(); }
+
+    float* real() { return realData; }                  // width x height samples
+    fftwf_complex* spectrum() { return spectrumData; }  // height x (width/2+1) bins
+    fftwf_complex* work() { return workData; }          // Scratch spectrum for inverse()
+
+    // real() -> spectrum()
+    void forward() { fftwf_execute(forwardPlan); }
+
+    // work() -> real(), unnormalized (scale by 1/(width*height)); destroys work()
+    void inverse() { fftwf_execute(inversePlan); }
+
+    // Smallest size >= n with no prime factors above 7, which FFTW transforms
+    // with its fast codelets; other sizes fall back to much slower algorithms
+    static uint32_t goodSize(uint32_t n) {
+        for (uint32_t m = std::max(n, 1u);; m++) {
+            uint32_t r = m;
+            for (uint32_t p : {2u, 3u, 5u, 7u}) {
+                while (r % p == 0) r /= p;
+            }
+            if (r == 1) return m;
+        }
+    }
+
+    // Threads used by plans created after this call (all cores by default).
+    // Lower it when several engines transform concurrently.
+    static void setThreads(int threads) {
+        initializeFftw();
+        std::lock_guard<std::mutex> lock(plannerMutex());
+        fftwf_plan_with_nthreads(std::max(1, threads));
+    }
+
+    static std::string wisdomPath() {
+        if (const char* path = std::getenv("SCAN_VIEWER_FFTW_WISDOM")) return path;
+        if (const char* home = std::getenv("HOME")) return std::string(home) + "/.scan_viewer_fftw_wisdom";
+        return ".scan_viewer_fftw_wisdom";
+    }
+
+private:
+    uint32_t width = 0, height = 0;
+    PlannerEffort effort = Measure;
+    PlannerEffort plannedEffort = Measure;
+    float* realData = nullptr;
+    fftwf_complex* spectrumData = nullptr;
+    fftwf_complex* workData = nullptr;
+    fftwf_plan forwardPlan = nullptr;
+    fftwf_plan inversePlan = nullptr;
+
+    static unsigned plannerFlags(PlannerEffort e) {
+        switch (e) {
+            case Patient: return FFTW_PATIENT;
+            case Measure: return FFTW_MEASURE;
+            default: return FFTW_ESTIMATE;
+        }
+    }
+
+    // The FFTW planner is global state shared by every engine instance
+    static std::mutex& plannerMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static void initializeFftw() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            if (fftwf_init_threads()) {
+                unsigned threads = std::thread::hardware_concurrency();
+                fftwf_plan_with_nthreads(threads > 0 ? static_cast<int>(threads) : 1);
+            } else {
+                std::cerr << "FFTW threads unavailable, using single-threaded transforms" << std::endl;
+            }
+            if (fftwf_import_wisdom_from_filename(wisdomPath().c_str())) {
+                std::cout << "Loaded FFTW wisdom from " << wisdomPath() << std::endl;
+            }
+        });
+    }
+};
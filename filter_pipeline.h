@@ -0,0 +1,536 @@
+#pragma once
+
+#include "bandpass_filter.h"
+#include "height_map.h"
+#include "parallel.h"
+#include "power_spectrum.h"
+#include "profiler.h"
+#include "surface_stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// One step of a FilterPipeline and its parameters
+struct FilterStage {
+    enum Type { Level = 0, Gaussian = 1, Median = 2, Clip = 3, Bandpass = 4 };
+
+    Type type = Bandpass;
+    bool enabled = true;
+    int order = 1;             // Level: least-squares polynomial order, 0 (mean) to 3; 1 is a plane
+    float sigma = 2.0f;        // Gaussian: standard deviation in samples
+    int radius = 1;            // Median: window of (2 * radius + 1)^2 samples
+    float clipSigma = 3.0f;    // Clip: standard deviations kept either side of the mean
+    float low = 0.0f, high = 0.0f;  // Bandpass: cutoffs in micrometers
+
+    // Equal stages produce the same output from the same input
+    bool operator==(const FilterStage& o) const {
+        if (type != o.type || enabled != o.enabled) return false;
+        if (!enabled) return true;
+        switch (type) {
+            case Level: return order == o.order;
+            case Gaussian: return sigma == o.sigma;
+            case Median: return radius == o.radius;
+            case Clip: return clipSigma == o.clipSigma;
+            default: return low == o.low && high == o.high;
+        }
+    }
+    bool operator!=(const FilterStage& o) const { return !(*this == o); }
+
+    static const char* name(Type t) {
+        switch (t) {
+            case Level: return "Level";
+            case Gaussian: return "Gaussian";
+            case Median: return "Median";
+            case Clip: return "Clip Outliers";
+            default: return "Bandpass";
+        }
+    }
+};
+
+// Runs a chain of filter stages over a height map. Every stage keeps its output,
+// and changing the stage list only invalidates the first changed stage and the
+// ones after it, so adjusting a late stage does not recompute the early ones.
+// A caller that keeps the result moves the last output out with takeOutput().
+// A bandpass stage also keeps its forward spectrum while its input is unchanged.
+//
+// The kernels split rows across threads and keep their inner loops contiguous
+// and branch-free so the compiler can vectorize them. Non-finite samples stay
+// non-finite and are left out of fits, statistics and neighborhoods.
+class FilterPipeline {
+public:
+    // Shares the map's storage; it must stay alive until the next setInput()
+    void setInput(const HeightMap& map) {
+        input = map;
+        invalidateFrom(0, true);
+    }
+
+    bool hasInput() const { return !input.empty(); }
+
+    // Replaces the stage list, keeping the outputs of unchanged leading stages.
+    // A bandpass only survives at an index that still holds a bandpass.
+    void setStages(const std::vector<FilterStage>& list) {
+        size_t first = 0;
+        while (first < list.size() && first < stages.size() && list[first] == stages[first]) first++;
+        for (size_t i = first; i < std::min(list.size(), stages.size()); i++) {
+            if (list[i].type != stages[i].type) caches[i].bandpass.reset();
+        }
+        stages = list;
+        caches.resize(stages.size());
+        invalidateFrom(first, false);
+    }
+
+    const std::vector<FilterStage>& stageList() const { return stages; }
+
+    void setPlannerEffort(FftEngine::PlannerEffort e) {
+        effort = e;
+        spectrumFft.setPlannerEffort(e);
+        invalidateBandpass();
+    }
+
+    void setEdgeHandling(BandpassFilter::Padding p, BandpassFilter::Window w) {
+        padding = p;
+        window = w;
+        invalidateBandpass();
+    }
+
+    // Recomputes the stages without a cached output. Returns false if a bandpass
+    // could not set up its FFT or cancelled() returned true; stages finished by
+    // then stay cached.
+    bool run(const std::function<bool()>& cancelled = nullptr, std::atomic<float>* progress = nullptr) {
+        if (!hasInput()) return false;
+        bool changed = false;
+        for (size_t i = 0; i < stages.size(); i++) {
+            Cache& cache = caches[i];
+            if (cache.valid) continue;
+            if (cancelled && cancelled()) return false;
+            if (progress) progress->store(static_cast<float>(i) / stages.size());
+            changed = true;
+            outputReplaced(i);
+            if (!stages[i].enabled) {
+                std::vector<float>().swap(cache.output);
+                cache.valid = true;
+                continue;
+            }
+            HeightMap in = stageInput(i);
+            cache.output.resize(in.size());
+            if (!apply(stages[i], cache, in, i == lastEnabled(), cancelled)) return false;
+            cache.valid = true;
+        }
+        if (changed || !rangeValid) updateRange();
+        if (progress) progress->store(1.0f);
+        return true;
+    }
+
+    // Output of the last stage: a view of its cached samples, or the input
+    // itself when no stage is enabled
+    HeightMap output() const { return stageInput(stages.size()); }
+
+    // Moves the last stage's output into out instead of copying it, so a caller
+    // that keeps the result does not hold the grid twice; out's previous storage
+    // is released. The stage is recomputed on the next run(), and output() must
+    // not be read until then. With no stage enabled the input is copied.
+    void takeOutput(std::vector<float>& out) {
+        size_t last = lastEnabled();
+        if (last < stages.size()) {
+            out.swap(caches[last].output);
+            std::vector<float>().swap(caches[last].output);
+            caches[last].valid = false;
+            outputReplaced(last);
+            return;
+        }
+        out.resize(input.size());
+        float* dst = out.data();
+        parallelFor(input.size(), chunkCount(input.size()), [&](size_t, size_t begin, size_t end) {
+            input.copyTo(begin, end - begin, dst + begin);
+        });
+    }
+
+    // Finite Z range and statistics of output()
+    float outputMin() const { return stats.min; }
+    float outputMax() const { return stats.max; }
+    const SurfaceStats& outputStats() const { return stats; }
+
+    // Rings of the PSD outputSpectrum() returns; 0 (the default) releases its
+    // transform buffers. Set it before run() so a last bandpass stage takes it.
+    void setSpectrumBins(size_t bins) {
+        spectrumBins = bins;
+        if (bins == 0) spectrumFft.release();
+    }
+
+    // Radially averaged PSD of output(). When the last stage is a bandpass
+    // without a window, the PSD it took from its masked spectrum is returned;
+    // otherwise output() is transformed with an engine kept for the next result.
+    bool outputSpectrum(PowerSpectrum& out) {
+        if (spectrumBins == 0) return false;
+        size_t last = lastEnabled();
+        if (last < stages.size() && stages[last].type == FilterStage::Bandpass && caches[last].valid &&
+            caches[last].bandpass && caches[last].bandpass->outputSpectrum().power.size() == spectrumBins) {
+            out = caches[last].bandpass->outputSpectrum();
+            return true;
+        }
+        return PowerSpectrum::compute(output(), spectrumBins, spectrumFft, out);
+    }
+
+    // Stage outputs and FFT buffers held
+    size_t bytes() const {
+        size_t total = spectrumFft.bytes();
+        for (const auto& cache : caches) {
+            total += cache.output.capacity() * sizeof(float);
+            if (cache.bandpass) total += cache.bandpass->bytes();
+        }
+        return total;
+    }
+
+    // Cached output bytes a stage list needs for a map of the given size
+    static size_t outputBytes(const std::vector<FilterStage>& list, size_t samples) {
+        size_t enabled = 0;
+        for (const auto& stage : list) enabled += stage.enabled;
+        return enabled * samples * sizeof(float);
+    }
+
+private:
+    struct Cache {
+        std::vector<float> output;
+        std::unique_ptr<BandpassFilter> bandpass;
+        bool valid = false;
+        bool inputChanged = true;  // The stage's input differs from what its bandpass last saw
+    };
+
+    HeightMap input;
+    std::vector<FilterStage> stages;
+    std::vector<Cache> caches;
+    FftEngine::PlannerEffort effort = FftEngine::Measure;
+    BandpassFilter::Padding padding = BandpassFilter::MirrorPadding;
+    BandpassFilter::Window window = BandpassFilter::NoWindow;
+    SurfaceStats stats;
+    bool rangeValid = false;
+    size_t spectrumBins = 0;
+    FftEngine spectrumFft;  // Transforms output() for a PSD no bandpass took
+
+    // Index of the last enabled stage, or stages.size() if there is none
+    size_t lastEnabled() const {
+        for (size_t i = stages.size(); i-- > 0;) {
+            if (stages[i].enabled) return i;
+        }
+        return stages.size();
+    }
+
+    // Stages from first on must be recomputed; later ones also see a new input
+    void invalidateFrom(size_t first, bool inputChanged) {
+        for (size_t i = first; i < caches.size(); i++) {
+            caches[i].valid = false;
+            if (i > first || inputChanged) caches[i].inputChanged = true;
+        }
+        rangeValid = false;
+    }
+
+    // The output buffer of stage index is about to be rewritten, reallocated or
+    // handed out. Bandpass filters after it hold views of their input, so they
+    // must be given the new one before they run again.
+    void outputReplaced(size_t index) {
+        for (size_t i = index + 1; i < caches.size(); i++) caches[i].inputChanged = true;
+    }
+
+    // Bandpass filters are recreated with the new settings on their next run
+    void invalidateBandpass() {
+        size_t first = stages.size();
+        for (size_t i = 0; i < stages.size(); i++) {
+            if (stages[i].type != FilterStage::Bandpass) continue;
+            caches[i].bandpass.reset();
+            first = std::min(first, i);
+        }
+        invalidateFrom(first, false);
+    }
+
+    // Output of the last enabled stage before index, or the pipeline input
+    HeightMap stageInput(size_t index) const {
+        for (size_t i = index; i-- > 0;) {
+            if (stages[i].enabled) return HeightMap::view(caches[i].output.data(), input.width, input.height);
+        }
+        return input;
+    }
+
+    void updateRange() {
+        stats = SurfaceStats::compute(output());
+        rangeValid = true;
+    }
+
+    bool apply(const FilterStage& stage, Cache& cache, const HeightMap& in, bool last,
+               const std::function<bool()>& cancelled) {
+        float* out = cache.output.data();
+        switch (stage.type) {
+            case FilterStage::Level: {
+                ScopedTimer timer("Level");
+                level(in, stage.order, out);
+                return true;
+            }
+            case FilterStage::Gaussian: {
+                ScopedTimer timer("Gaussian");
+                gaussian(in, stage.sigma, out);
+                return true;
+            }
+            case FilterStage::Median: {
+                ScopedTimer timer("Median");
+                median(in, stage.radius, out);
+                return true;
+            }
+            case FilterStage::Clip: {
+                ScopedTimer timer("Clip outliers");
+                clip(in, stage.clipSigma, out);
+                return true;
+            }
+            default: {
+                if (!cache.bandpass) {
+                    cache.bandpass.reset(new BandpassFilter());
+                    cache.bandpass->setPlannerEffort(effort);
+                    cache.bandpass->setEdgeHandling(padding, window);
+                    cache.inputChanged = true;
+                }
+                if (cache.inputChanged) cache.bandpass->setInput(in);
+                cache.inputChanged = false;
+                cache.bandpass->setSpectrumBins(last ? spectrumBins : 0);
+                float lo, hi;
+                return cache.bandpass->apply(stage.low, stage.high, out, lo, hi, cancelled);
+            }
+        }
+    }
+
+    // Row-parallel loop over the map with a float scratch row per chunk
+    template <typename RowFn>
+    static void forRows(const HeightMap& map, RowFn fn) {
+        parallelFor(map.height, chunkCount(map.size()), [&](size_t, size_t begin, size_t end) {
+            std::vector<float> scratch(map.width);
+            for (size_t y = begin; y < end; y++) {
+                fn(static_cast<uint32_t>(y), map.row(static_cast<uint32_t>(y), scratch.data()));
+            }
+        });
+    }
+
+    // Subtracts the least-squares polynomial in x and y of the given order. Only
+    // power sums are accumulated per row (u^a for a <= 2 * order), which form the
+    // normal equations once combined with the row's v powers, so the per-sample
+    // cost does not grow with the number of terms. Coordinates are scaled to
+    // -1..1 to keep the system well conditioned; partial sums are in double and
+    // combined in chunk order.
+    static void level(const HeightMap& in, int order, float* out) {
+        const int p = std::max(0, std::min(order, 3));
+        const int powers = 2 * p + 1;
+        uint32_t w = in.width, h = in.height;
+        auto coordinate = [](uint32_t i, uint32_t n) { return n > 1 ? 2.0 * i / (n - 1) - 1.0 : 0.0; };
+
+        struct Partial {
+            double moments[7][7] = {};   // sum u^a v^b
+            double zMoments[4][4] = {};  // sum z u^a v^b
+        };
+        size_t chunks = chunkCount(in.size());
+        std::vector<Partial> partial(chunks);
+        parallelFor(h, chunks, [&](size_t chunk, size_t begin, size_t end) {
+            Partial& part = partial[chunk];
+            std::vector<float> scratch(w);
+            for (size_t y = begin; y < end; y++) {
+                const float* z = in.row(static_cast<uint32_t>(y), scratch.data());
+                double sums[7] = {}, zSums[4] = {};
+                for (uint32_t x = 0; x < w; x++) {
+                    if (!std::isfinite(z[x])) continue;
+                    double u = coordinate(x, w), power = 1.0;
+                    for (int a = 0; a < powers; a++) {
+                        sums[a] += power;
+                        if (a <= p) zSums[a] += z[x] * power;
+                        power *= u;
+                    }
+                }
+                double v = coordinate(static_cast<uint32_t>(y), h), vPower = 1.0;
+                for (int b = 0; b < powers; b++) {
+                    for (int a = 0; a + b < powers; a++) part.moments[a][b] += sums[a] * vPower;
+                    for (int a = 0; a + b <= p; a++) part.zMoments[a][b] += zSums[a] * vPower;
+                    vPower *= v;
+                }
+            }
+        });
+        Partial total;
+        for (const Partial& part : partial) {
+            for (int a = 0; a < 7; a++) {
+                for (int b = 0; b < 7; b++) total.moments[a][b] += part.moments[a][b];
+            }
+            for (int a = 0; a < 4; a++) {
+                for (int b = 0; b < 4; b++) total.zMoments[a][b] += part.zMoments[a][b];
+            }
+        }
+
+        // Terms u^a v^b with a + b <= p
+        std::vector<std::pair<int, int>> terms;
+        for (int d = 0; d <= p; d++) {
+            for (int b = 0; b <= d; b++) terms.emplace_back(d - b, b);
+        }
+        size_t m = terms.size();
+        std::vector<double> system(m * (m + 1));
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < m; j++) {
+                system[i * (m + 1) + j] = total.moments[terms[i].first + terms[j].first][terms[i].second + terms[j].second];
+            }
+            system[i * (m + 1) + m] = total.zMoments[terms[i].first][terms[i].second];
+        }
+        std::vector<double> coefficients = solve(system, m);
+
+        forRows(in, [&](uint32_t y, const float* z) {
+            // Collapse the fit to a polynomial in u for this row, then evaluate with Horner
+            double v = coordinate(y, h);
+            double rowPoly[4] = {};
+            for (size_t t = 0; t < m; t++) rowPoly[terms[t].first] += coefficients[t] * std::pow(v, terms[t].second);
+            float* dst = out + static_cast<size_t>(y) * w;
+            for (uint32_t x = 0; x < w; x++) {
+                double u = coordinate(x, w);
+                double fit = ((rowPoly[3] * u + rowPoly[2]) * u + rowPoly[1]) * u + rowPoly[0];
+                dst[x] = static_cast<float>(z[x] - fit);
+            }
+        });
+    }
+
+    // Gaussian elimination with partial pivoting on an m x (m + 1) augmented
+    // matrix; coefficients of singular directions are left at zero
+    static std::vector<double> solve(std::vector<double>& a, size_t m) {
+        size_t stride = m + 1;
+        std::vector<double> x(m, 0.0);
+        std::vector<bool> singular(m, false);
+        for (size_t col = 0; col < m; col++) {
+            size_t pivot = col;
+            for (size_t r = col + 1; r < m; r++) {
+                if (std::abs(a[r * stride + col]) > std::abs(a[pivot * stride + col])) pivot = r;
+            }
+            if (std::abs(a[pivot * stride + col]) < 1e-12) {
+                singular[col] = true;
+                continue;
+            }
+            for (size_t c = 0; c < stride; c++) std::swap(a[col * stride + c], a[pivot * stride + c]);
+            for (size_t r = col + 1; r < m; r++) {
+                double f = a[r * stride + col] / a[col * stride + col];
+                for (size_t c = col; c < stride; c++) a[r * stride + c] -= f * a[col * stride + c];
+            }
+        }
+        for (size_t col = m; col-- > 0;) {
+            if (singular[col]) continue;
+            double sum = a[col * stride + m];
+            for (size_t c = col + 1; c < m; c++) sum -= a[col * stride + c] * x[c];
+            x[col] = sum / a[col * stride + col];
+        }
+        return x;
+    }
+
+    // Adds tap weight wk times src to sum and weight wherever src is finite
+    static void accumulate(const float* src, float wk, float* sum, float* weight, int64_t begin, int64_t end) {
+        for (int64_t x = begin; x < end; x++) {
+            float v = src[x];
+            bool valid = std::isfinite(v);
+            sum[x] += valid ? wk * v : 0.0f;
+            weight[x] += valid ? wk : 0.0f;
+        }
+    }
+
+    // Separable Gaussian, horizontal then vertical. Each pass is a normalized
+    // convolution: taps outside the map or on non-finite samples are dropped and
+    // the remaining weights renormalized, so edges and holes are not darkened.
+    static void gaussian(const HeightMap& in, float sigma, float* out) {
+        uint32_t w = in.width, h = in.height;
+        sigma = std::max(sigma, 0.1f);
+        int radius = std::max(1, static_cast<int>(std::ceil(3.0f * sigma)));
+        std::vector<float> kernel(2 * radius + 1);
+        for (int k = -radius; k <= radius; k++) kernel[k + radius] = std::exp(-0.5f * k * k / (sigma * sigma));
+
+        std::vector<float> horizontal(in.size());
+        parallelFor(h, chunkCount(in.size()), [&](size_t, size_t begin, size_t end) {
+            std::vector<float> sum(w), weight(w), scratch(w);
+            for (size_t y = begin; y < end; y++) {
+                const float* z = in.row(static_cast<uint32_t>(y), scratch.data());
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                std::fill(weight.begin(), weight.end(), 0.0f);
+                for (int k = -radius; k <= radius; k++) {
+                    // Output x reads input x + k
+                    int64_t x0 = std::max<int64_t>(0, -k);
+                    int64_t x1 = std::min<int64_t>(w, static_cast<int64_t>(w) - k);
+                    if (x0 < x1) accumulate(z + k, kernel[k + radius], sum.data(), weight.data(), x0, x1);
+                }
+                float* dst = horizontal.data() + y * w;
+                for (uint32_t x = 0; x < w; x++) dst[x] = weight[x] > 0.0f ? sum[x] / weight[x] : z[x];
+            }
+        });
+
+        parallelFor(h, chunkCount(in.size()), [&](size_t, size_t begin, size_t end) {
+            std::vector<float> sum(w), weight(w), scratch(w);
+            for (size_t y = begin; y < end; y++) {
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                std::fill(weight.begin(), weight.end(), 0.0f);
+                int64_t k0 = std::max<int64_t>(-radius, -static_cast<int64_t>(y));
+                int64_t k1 = std::min<int64_t>(radius, static_cast<int64_t>(h) - 1 - static_cast<int64_t>(y));
+                for (int64_t k = k0; k <= k1; k++) {
+                    accumulate(horizontal.data() + (y + k) * w, kernel[k + radius], sum.data(), weight.data(), 0, w);
+                }
+                const float* z = in.row(static_cast<uint32_t>(y), scratch.data());
+                float* dst = out + y * w;
+                for (uint32_t x = 0; x < w; x++) {
+                    dst[x] = std::isfinite(z[x]) && weight[x] > 0.0f ? sum[x] / weight[x] : z[x];
+                }
+            }
+        });
+    }
+
+    // Median of the finite samples in a (2 * radius + 1)^2 window, clipped at the
+    // map edges. The rows of the window are read once per output row.
+    static void median(const HeightMap& in, int radius, float* out) {
+        uint32_t w = in.width, h = in.height;
+        int r = std::max(1, radius);
+        parallelFor(h, chunkCount(in.size(), 1 << 14), [&](size_t, size_t begin, size_t end) {
+            std::vector<std::vector<float>> scratch(2 * r + 1, std::vector<float>(w));
+            std::vector<const float*> rows(2 * r + 1);
+            std::vector<float> window;
+            window.reserve((2 * r + 1) * (2 * r + 1));
+            for (size_t y = begin; y < end; y++) {
+                int64_t k0 = std::max<int64_t>(-r, -static_cast<int64_t>(y));
+                int64_t k1 = std::min<int64_t>(r, static_cast<int64_t>(h) - 1 - static_cast<int64_t>(y));
+                for (int64_t k = k0; k <= k1; k++) {
+                    rows[k + r] = in.row(static_cast<uint32_t>(y + k), scratch[k + r].data());
+                }
+                const float* center = rows[r];
+                float* dst = out + y * w;
+                for (uint32_t x = 0; x < w; x++) {
+                    if (!std::isfinite(center[x])) {
+                        dst[x] = center[x];
+                        continue;
+                    }
+                    uint32_t x0 = x >= static_cast<uint32_t>(r) ? x - r : 0;
+                    uint32_t x1 = std::min(x + r + 1, w);
+                    window.clear();
+                    for (int64_t k = k0; k <= k1; k++) {
+                        const float* row = rows[k + r];
+                        for (uint32_t i = x0; i < x1; i++) {
+                            if (std::isfinite(row[i])) window.push_back(row[i]);
+                        }
+                    }
+                    auto middle = window.begin() + window.size() / 2;
+                    std::nth_element(window.begin(), middle, window.end());
+                    dst[x] = *middle;
+                }
+            }
+        });
+    }
+
+    // Clamps samples to mean +- k standard deviations of the finite samples
+    static void clip(const HeightMap& in, float k, float* out) {
+        SurfaceStats stats = SurfaceStats::compute(in);
+        float lo = static_cast<float>(stats.mean - k * stats.stdDev);
+        float hi = static_cast<float>(stats.mean + k * stats.stdDev);
+        uint32_t w = in.width;
+        forRows(in, [&](uint32_t y, const float* z) {
+            float* dst = out + static_cast<size_t>(y) * w;
+            for (uint32_t x = 0; x < w; x++) {
+                // std::max/min alone would turn NaN into a bound
+                float clamped = std::max(lo, std::min(z[x], hi));
+                dst[x] = std::isfinite(z[x]) ? clamped : z[x];
+            }
+        });
+    }
+};
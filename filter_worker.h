@@ -0,0 +1,182 @@
+#pragma once
+
+#include "filter_pipeline.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs a FilterPipeline on a background thread.
+//
+// Requests are coalesced: only the most recent stage list is kept, and a running
+// pipeline is abandoned between stages as soon as a newer request arrives; the
+// stages it finished stay cached for the next run. The last stage's output is
+// moved into a back buffer rather than copied, then swapped into a front buffer
+// that the render thread collects with takeResult(), so a result is held once.
+// The statistics of each result, and its radially averaged PSD when asked for,
+// are computed on the worker as well.
+class FilterWorker {
+public:
+    FilterWorker() : thread(&FilterWorker::loop, this) {}
+
+    ~FilterWorker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            latestGeneration++;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    FilterWorker(const FilterWorker&) = delete;
+    FilterWorker& operator=(const FilterWorker&) = delete;
+
+    // Cancels pending work and waits for the worker to go idle before switching
+    // input. The map's storage is shared, not copied; a view must stay alive and
+    // unchanged until the next setInput(). Result buffers are allocated on the
+    // first request, so scans that are never filtered cost no extra memory.
+    void setInput(const HeightMap& map) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cancelLocked(lock);
+        pipeline.setInput(map);
+        std::vector<float>().swap(backBuffer);
+        std::vector<float>().swap(frontBuffer);
+        resultReady = false;
+    }
+
+    void setPlannerEffort(FftEngine::PlannerEffort e) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cancelLocked(lock);
+        pipeline.setPlannerEffort(e);
+    }
+
+    void setEdgeHandling(BandpassFilter::Padding padding, BandpassFilter::Window window) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cancelLocked(lock);
+        pipeline.setEdgeHandling(padding, window);
+    }
+
+    // Replaces any request that has not started yet
+    void request(const std::vector<FilterStage>& stages) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!pipeline.hasInput()) return;
+            pendingStages = stages;
+            hasPending = true;
+            latestGeneration++;
+        }
+        wake.notify_all();
+    }
+
+    // Drops pending work and waits until the worker is idle
+    void cancel() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cancelLocked(lock);
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running || hasPending;
+    }
+
+    float progress() const { return currentProgress.load(); }
+
+    // Result buffers, cached stage outputs and FFT buffers currently held by the worker
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (backBuffer.capacity() + frontBuffer.capacity()) * sizeof(float) + pipelineBytes;
+    }
+
+    // Rings of the PSD computed for each result; 0 (the default) skips it
+    void setSpectrumBins(size_t bins) {
+        std::lock_guard<std::mutex> lock(mutex);
+        spectrumBins = bins;
+    }
+
+    // Swaps the newest finished result into zMap and releases the previous
+    // contents of zMap
+    bool takeResult(std::vector<float>& zMap, float& zMin, float& zMax, SurfaceStats* stats = nullptr,
+                    PowerSpectrum* spectrum = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!resultReady) return false;
+        zMap.swap(frontBuffer);
+        std::vector<float>().swap(frontBuffer);
+        zMin = resultStats.min;
+        zMax = resultStats.max;
+        if (stats) *stats = resultStats;
+        if (spectrum) *spectrum = resultSpectrum;
+        resultReady = false;
+        return true;
+    }
+
+private:
+    FilterPipeline pipeline;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::vector<float> backBuffer;   // Result of the current run, moved out of the pipeline
+    std::vector<float> frontBuffer;  // Latest finished result
+    std::vector<FilterStage> pendingStages;
+    SurfaceStats resultStats;
+    PowerSpectrum resultSpectrum;
+    size_t spectrumBins = 0;
+    size_t pipelineBytes = 0;  // pipeline.bytes() as of the last run; the worker owns the pipeline
+    bool hasPending = false;
+    bool running = false;
+    bool resultReady = false;
+    bool stopping = false;
+    std::atomic<uint64_t> latestGeneration{0};
+    std::atomic<float> currentProgress{0.0f};
+    std::thread thread;
+
+    void cancelLocked(std::unique_lock<std::mutex>& lock) {
+        hasPending = false;
+        latestGeneration++;
+        idle.wait(lock, [this] { return !running; });
+        resultReady = false;
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || hasPending; });
+            if (stopping) break;
+
+            pipeline.setStages(pendingStages);
+            uint64_t generation = latestGeneration.load();
+            hasPending = false;
+            running = true;
+            // A result abandoned by a newer request is not kept while the next one runs
+            std::vector<float>().swap(backBuffer);
+            pipeline.setSpectrumBins(spectrumBins);
+            lock.unlock();
+
+            auto cancelled = [this, generation] { return latestGeneration.load() != generation; };
+            bool finished = pipeline.run(cancelled, &currentProgress) && !cancelled();
+            SurfaceStats stats = pipeline.outputStats();
+            PowerSpectrum spectrum;
+            if (finished) pipeline.outputSpectrum(spectrum);
+            std::vector<float> result;
+            if (finished) pipeline.takeOutput(result);
+
+            size_t heldBytes = pipeline.bytes();
+            lock.lock();
+            backBuffer.swap(result);
+            pipelineBytes = heldBytes;
+            running = false;
+            if (finished && generation == latestGeneration.load()) {
+                backBuffer.swap(frontBuffer);
+                resultStats = stats;
+                resultSpectrum = std::move(spectrum);
+                resultReady = true;
+            }
+            idle.notify_all();
+        }
+        running = false;
+        idle.notify_all();
+    }
+};
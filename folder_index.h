@@ -0,0 +1,326 @@
+#pragma once
+
+#include "parallel.h"
+#include "tiff_decoder.h"
+#include "user_cache.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Header metadata, Z range and a small grayscale thumbnail of one scan
+struct IndexEntry {
+    enum State { Pending, Ready, Failed };
+
+    std::string name;                    // File name within the folder
+    int64_t modified = 0, fileSize = 0;  // Stamp the entry was built from
+    State state = Pending;
+    std::string error;
+    TiffInfo info;
+    float zMin = 0.0f, zMax = 0.0f;
+    uint64_t invalid = 0;
+    uint32_t thumbWidth = 0, thumbHeight = 0;
+    std::vector<uint8_t> thumbnail;  // thumbWidth x thumbHeight, zMin..zMax mapped to 0..255
+};
+
+// Indexes the TIFF files of a folder in the background.
+//
+// Each file is streamed once, block by block, to collect its Z range and a box
+// filtered thumbnail without holding the full grid in memory; files are indexed
+// in parallel. Results are stored in a sidecar file in the folder, keyed by file
+// name, mtime and size, so reopening the folder only indexes new or changed files.
+// Read-only folders keep their sidecar under $XDG_CACHE_HOME/scan_viewer instead.
+// The UI thread polls snapshot() and never waits on the indexer.
+class FolderIndex {
+public:
+    static constexpr uint32_t ThumbnailSize = 64;
+
+    ~FolderIndex() { stop(); }
+
+    // Starts indexing files (names within folder), cancelling any previous run
+    void open(const std::string& folder, const std::vector<std::string>& files) {
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            for (const auto& name : files) {
+                IndexEntry entry;
+                entry.name = name;
+                entries[name] = entry;
+            }
+            indexed = 0;
+            pending = files.size();
+            version++;
+        }
+        cancelled = false;
+        worker = std::thread(&FolderIndex::build, this, folder, files);
+    }
+
+    void stop() {
+        cancelled = true;
+        if (worker.joinable()) worker.join();
+    }
+
+    // Copies the entries if they changed since lastVersion; returns false otherwise
+    bool snapshot(std::map<std::string, IndexEntry>& out, uint64_t& lastVersion) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (version == lastVersion) return false;
+        out = entries;
+        lastVersion = version;
+        return true;
+    }
+
+    // Files indexed so far out of those that needed indexing
+    void progress(size_t& done, size_t& total) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = indexed;
+        total = pending;
+    }
+
+    // The sidecar inside folder if it is writable, otherwise one in the user's
+    // cache directory named after a hash of the folder's absolute path
+    static std::string sidecarPath(const std::string& folder) {
+        if (access(folder.c_str(), W_OK) == 0) return localSidecarPath(folder);
+        return UserCache::pathFor(folder, ".index");
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::map<std::string, IndexEntry> entries;
+    uint64_t version = 0;
+    size_t indexed = 0, pending = 0;
+    std::atomic<bool> cancelled{false};
+    std::thread worker;
+
+    void build(std::string folder, std::vector<std::string> files) {
+        // A read-only folder may still hold a sidecar from when it was writable;
+        // entries in the cache directory's copy are newer
+        std::string path = sidecarPath(folder);
+        std::map<std::string, IndexEntry> stored;
+        if (path != localSidecarPath(folder)) loadSidecar(localSidecarPath(folder), stored);
+        loadSidecar(path, stored);
+
+        // Reuse entries whose file is unchanged
+        std::vector<IndexEntry> stale;
+        for (const auto& name : files) {
+            IndexEntry entry;
+            entry.name = name;
+            struct stat st;
+            if (stat((folder + "/" + name).c_str(), &st) == 0) {
+                entry.modified = static_cast<int64_t>(st.st_mtime);
+                entry.fileSize = static_cast<int64_t>(st.st_size);
+            }
+            auto it = stored.find(name);
+            if (it != stored.end() && it->second.modified == entry.modified && it->second.fileSize == entry.fileSize) {
+                std::lock_guard<std::mutex> lock(mutex);
+                entries[name] = it->second;
+            } else {
+                stale.push_back(entry);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = stale.size();
+            version++;
+        }
+        if (stale.empty()) return;
+
+        std::atomic<size_t> next{0};
+        size_t threads = std::min<size_t>(hardwareThreads(), stale.size());
+        parallelFor(threads, threads, [&](size_t, size_t, size_t) {
+            for (size_t i = next++; i < stale.size() && !cancelled; i = next++) {
+                IndexEntry& entry = stale[i];
+                indexFile(folder + "/" + entry.name, entry);
+                std::lock_guard<std::mutex> lock(mutex);
+                entries[entry.name] = entry;
+                indexed++;
+                version++;
+            }
+        });
+        if (cancelled) return;
+
+        std::map<std::string, IndexEntry> current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = entries;
+        }
+        saveSidecar(path, current);
+    }
+
+    static std::string localSidecarPath(const std::string& folder) { return folder + "/.scan_viewer_index"; }
+
+    // Streams the file block by block into the Z range and thumbnail accumulators
+    static void indexFile(const std::string& path, IndexEntry& entry) {
+        TIFF* tif = TIFFOpen(path.c_str(), "r");
+        if (!tif) {
+            entry.state = IndexEntry::Failed;
+            entry.error = "Failed to open TIFF file";
+            return;
+        }
+        TiffInfo& info = entry.info;
+        if (!TiffDecoder::readInfo(tif, info, entry.error)) {
+            TIFFClose(tif);
+            entry.state = IndexEntry::Failed;
+            return;
+        }
+
+        float aspect = static_cast<float>(info.width) / info.height;
+        entry.thumbWidth = std::max(1u, std::min(info.width, aspect >= 1.0f ? ThumbnailSize : static_cast<uint32_t>(ThumbnailSize * aspect)));
+        entry.thumbHeight = std::max(1u, std::min(info.height, aspect >= 1.0f ? static_cast<uint32_t>(ThumbnailSize / aspect) : ThumbnailSize));
+        std::vector<double> sums(static_cast<size_t>(entry.thumbWidth) * entry.thumbHeight, 0.0);
+        std::vector<uint32_t> counts(sums.size(), 0);
+
+        TiffDecoder::ConvertFn convert = TiffDecoder::converterFor(info);
+        tmsize_t blockSize = info.tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+        std::vector<char> buffer(blockSize);
+        std::vector<float> row(info.blockWidth);
+        size_t bytesPerSample = info.bitsPerSample / 8;
+        uint32_t blocksAcross = (info.width + info.blockWidth - 1) / info.blockWidth;
+        SampleStats stats;
+
+        for (uint32_t block = 0; block < info.blockCount; block++) {
+            tmsize_t read = info.tiled ? TIFFReadEncodedTile(tif, block, buffer.data(), blockSize)
+                                       : TIFFReadEncodedStrip(tif, block, buffer.data(), blockSize);
+            if (read < 0) {
+                TIFFClose(tif);
+                entry.state = IndexEntry::Failed;
+                entry.error = "Failed to read " + std::string(info.tiled ? "tile " : "strip ") + std::to_string(block);
+                return;
+            }
+            uint32_t x0 = (block % blocksAcross) * info.blockWidth;
+            uint32_t y0 = (block / blocksAcross) * info.blockHeight;
+            uint32_t cols = std::min(info.blockWidth, info.width - x0);
+            uint32_t rows = std::min(info.blockHeight, info.height - y0);
+            for (uint32_t r = 0; r < rows; r++) {
+                convert(buffer.data() + static_cast<size_t>(r) * info.blockWidth * bytesPerSample, row.data(), cols, stats);
+                size_t ty = static_cast<size_t>(y0 + r) * entry.thumbHeight / info.height;
+                double* sumRow = sums.data() + ty * entry.thumbWidth;
+                uint32_t* countRow = counts.data() + ty * entry.thumbWidth;
+                for (uint32_t c = 0; c < cols; c++) {
+                    if (!std::isfinite(row[c])) continue;
+                    size_t tx = static_cast<size_t>(x0 + c) * entry.thumbWidth / info.width;
+                    sumRow[tx] += row[c];
+                    countRow[tx]++;
+                }
+            }
+        }
+        TIFFClose(tif);
+
+        stats.finish();
+        entry.zMin = stats.min;
+        entry.zMax = stats.max;
+        entry.invalid = stats.invalid;
+        float range = stats.max > stats.min ? stats.max - stats.min : 1.0f;
+        entry.thumbnail.resize(sums.size());
+        for (size_t i = 0; i < sums.size(); i++) {
+            float t = counts[i] ? (static_cast<float>(sums[i] / counts[i]) - stats.min) / range : 0.0f;
+            entry.thumbnail[i] = static_cast<uint8_t>(std::max(0.0f, std::min(t, 1.0f)) * 255.0f + 0.5f);
+        }
+        entry.state = IndexEntry::Ready;
+    }
+
+    // Sidecar layout: magic, entry count, then per entry the name, stamp, state,
+    // header fields, Z range and thumbnail. Little-endian host layout.
+    static constexpr uint32_t SidecarMagic = 0x31584453;  // "SDX1"
+
+    template <typename T>
+    static void put(std::ofstream& out, const T& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    template <typename T>
+    static bool get(std::ifstream& in, T& value) { return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T))); }
+
+    static void putString(std::ofstream& out, const std::string& s) {
+        put(out, static_cast<uint32_t>(s.size()));
+        out.write(s.data(), s.size());
+    }
+
+    static bool getString(std::ifstream& in, std::string& s) {
+        uint32_t size = 0;
+        if (!get(in, size) || size > 4096) return false;
+        s.resize(size);
+        return static_cast<bool>(in.read(&s[0], size));
+    }
+
+    static void loadSidecar(const std::string& path, std::map<std::string, IndexEntry>& out) {
+        std::ifstream in(path, std::ios::binary);
+        uint32_t magic = 0, count = 0;
+        if (!in || !get(in, magic) || magic != SidecarMagic || !get(in, count)) return;
+        for (uint32_t i = 0; i < count; i++) {
+            IndexEntry e;
+            uint8_t state = 0, tiled = 0, bigTiff = 0;
+            TiffInfo& info = e.info;
+            if (!getString(in, e.name) || !get(in, e.modified) || !get(in, e.fileSize) || !get(in, state) ||
+                !getString(in, e.error) || !get(in, info.width) || !get(in, info.height) ||
+                !get(in, info.bitsPerSample) || !get(in, info.sampleFormat) || !get(in, info.compression) ||
+                !get(in, tiled) || !get(in, bigTiff) || !get(in, e.zMin) || !get(in, e.zMax) || !get(in, e.invalid) ||
+                !get(in, e.thumbWidth) || !get(in, e.thumbHeight) ||
+                e.thumbWidth > ThumbnailSize || e.thumbHeight > ThumbnailSize) {
+                std::cerr << "Ignoring corrupt folder index " << path << std::endl;
+                out.clear();
+                return;
+            }
+            e.state = static_cast<IndexEntry::State>(state);
+            info.tiled = tiled != 0;
+            info.bigTiff = bigTiff != 0;
+            e.thumbnail.resize(static_cast<size_t>(e.thumbWidth) * e.thumbHeight);
+            if (!in.read(reinterpret_cast<char*>(e.thumbnail.data()), e.thumbnail.size())) {
+                out.clear();
+                return;
+            }
+            out[e.name] = e;
+        }
+    }
+
+    // Written to a temporary file and renamed, so a crash never leaves a torn index
+    static void saveSidecar(const std::string& path, const std::map<std::string, IndexEntry>& entries) {
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                std::cerr << "Failed to write folder index " << path << std::endl;
+                return;
+            }
+            put(out, SidecarMagic);
+            uint32_t count = 0;
+            for (const auto& kv : entries) count += kv.second.state != IndexEntry::Pending;
+            put(out, count);
+            for (const auto& kv : entries) {
+                const IndexEntry& e = kv.second;
+                if (e.state == IndexEntry::Pending) continue;
+                putString(out, e.name);
+                put(out, e.modified);
+                put(out, e.fileSize);
+                put(out, static_cast<uint8_t>(e.state));
+                putString(out, e.error);
+                put(out, e.info.width);
+                put(out, e.info.height);
+                put(out, e.info.bitsPerSample);
+                put(out, e.info.sampleFormat);
+                put(out, e.info.compression);
+                put(out, static_cast<uint8_t>(e.info.tiled));
+                put(out, static_cast<uint8_t>(e.info.bigTiff));
+                put(out, e.zMin);
+                put(out, e.zMax);
+                put(out, e.invalid);
+                put(out, e.thumbWidth);
+                put(out, e.thumbHeight);
+                out.write(reinterpret_cast<const char*>(e.thumbnail.data()), e.thumbnail.size());
+            }
+            if (!out) {
+                std::cerr << "Failed to write folder index " << path << std::endl;
+                std::remove(temp.c_str());
+                return;
+            }
+        }
+        std::rename(temp.c_str(), path.c_str());
+    }
+};
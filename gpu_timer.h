@@ -0,0 +1,73 @@
+#pragma once
+
+#include "profiler.h"
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+// Measures GPU time of a stretch of GL commands with GL_TIME_ELAPSED queries and
+// records it in the Profiler on the GPU timeline. Queries rotate through a small
+// ring and are read back a few frames later, once their results are available,
+// so measuring never stalls the pipeline. Does nothing without ARB_timer_query.
+class GpuTimer {
+public:
+    explicit GpuTimer(const char* name) : name(name) {}
+
+    ~GpuTimer() { destroy(); }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void begin() {
+        if (!GLEW_ARB_timer_query) return;
+        if (queries.empty()) {
+            queries.resize(RingSize);
+            glGenQueries(RingSize, queries.data());
+            startUs.assign(RingSize, -1);
+        }
+        collect();
+        // Every query is still in flight: skip this measurement rather than wait
+        if (startUs[next] >= 0) return;
+        glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+        startUs[next] = Profiler::nowUs();
+        active = true;
+    }
+
+    void end() {
+        if (!active) return;
+        glEndQuery(GL_TIME_ELAPSED);
+        next = (next + 1) % RingSize;
+        active = false;
+    }
+
+    void destroy() {
+        if (queries.empty()) return;
+        glDeleteQueries(RingSize, queries.data());
+        queries.clear();
+        startUs.clear();
+        active = false;
+    }
+
+private:
+    static constexpr int RingSize = 4;
+    const char* name;
+    std::vector<GLuint> queries;
+    std::vector<int64_t> startUs;  // CPU time the query began, -1 when free
+    int next = 0;
+    bool active = false;
+
+    // Records finished queries, oldest first
+    void collect() {
+        for (int i = 0; i < RingSize; i++) {
+            int slot = (next + i) % RingSize;
+            if (startUs[slot] < 0) continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &ns);
+            Profiler::instance().record(name, startUs[slot], static_cast<int64_t>(ns / 1000), 0);
+            startUs[slot] = -1;
+        }
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// Half-open rectangle [x0, x1) x [y0, y1) of grid samples
+struct GridRect {
+    uint32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    uint32_t width() const { return x1 > x0 ? x1 - x0 : 0; }
+    uint32_t height() const { return y1 > y0 ? y1 - y0 : 0; }
+    size_t size() const { return static_cast<size_t>(width()) * height(); }
+    bool empty() const { return width() == 0 || height() == 0; }
+    bool operator==(const GridRect& o) const { return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1; }
+    bool operator!=(const GridRect& o) const { return !(*this == o); }
+
+    // Samples of the next pyramid level that are reduced from this rectangle
+    GridRect halved() const { return GridRect{x0 / 2, y0 / 2, (x1 + 1) / 2, (y1 + 1) / 2}; }
+};
+
+// A row-major grid of height samples stored once, either as floats or at the
+// native integer precision of the source file (z = v * scale + offset).
+//
+// Copies share the underlying buffer. Consumers that need floats use read()/row(),
+// which return the samples in place for float storage and convert into a caller
+// supplied scratch buffer otherwise, so no full-size float copy is ever made.
+class HeightMap {
+public:
+    enum Format { Float32, UInt16, UInt8 };
+
+    // Allocates uninitialized owned storage
+    void allocate(uint32_t w, uint32_t h, Format f, float s = 1.0f, float o = 0.0f) {
+        size_t bytes = static_cast<size_t>(w) * h * sampleSize(f);
+        owner = std::shared_ptr<void>(new uint8_t[bytes], std::default_delete<uint8_t[]>());
+        samples = owner.get();
+        width = w;
+        height = h;
+        format = f;
+        scale = s;
+        offset = o;
+    }
+
+    // Non-owning float view; data must outlive every copy of the view
+    static HeightMap view(const float* data, uint32_t w, uint32_t h) {
+        HeightMap map;
+        map.samples = const_cast<float*>(data);
+        map.width = w;
+        map.height = h;
+        map.format = Float32;
+        return map;
+    }
+
+    // Samples kept alive by owner, e.g. a memory-mapped file
+    static HeightMap wrap(std::shared_ptr<void> owner, const void* data, uint32_t w, uint32_t h, Format f,
+                          float s = 1.0f, float o = 0.0f) {
+        HeightMap map;
+        map.owner = std::move(owner);
+        map.samples = const_cast<void*>(data);
+        map.width = w;
+        map.height = h;
+        map.format = f;
+        map.scale = s;
+        map.offset = o;
+        return map;
+    }
+
+    // Owned copy of the samples in rect, in the same storage format
+    HeightMap crop(const GridRect& rect) const {
+        HeightMap map;
+        map.allocate(rect.width(), rect.height(), format, scale, offset);
+        size_t sample = sampleSize(format);
+        size_t rowBytes = rect.width() * sample;
+        const uint8_t* src = static_cast<const uint8_t*>(samples);
+        uint8_t* dst = static_cast<uint8_t*>(map.samples);
+        for (uint32_t y = rect.y0; y < rect.y1; y++) {
+            std::memcpy(dst, src + (static_cast<size_t>(y) * width + rect.x0) * sample, rowBytes);
+            dst += rowBytes;
+        }
+        return map;
+    }
+
+    void clear() { *this = HeightMap(); }
+
+    bool empty() const { return samples == nullptr || width == 0 || height == 0; }
+    size_t size() const { return static_cast<size_t>(width) * height; }
+    size_t bytes() const { return owner ? size() * sampleSize(format) : 0; }  // Owned bytes only
+    static size_t sampleSize(Format f) { return f == Float32 ? 4 : f == UInt16 ? 2 : 1; }
+
+    const void* data() const { return samples; }
+    void* mutableData() { return samples; }
+    const float* floats() const { return format == Float32 ? static_cast<const float*>(samples) : nullptr; }
+
+    float at(size_t i) const {
+        switch (format) {
+            case UInt16: return static_cast<const uint16_t*>(samples)[i] * scale + offset;
+            case UInt8: return static_cast<const uint8_t*>(samples)[i] * scale + offset;
+            default: return static_cast<const float*>(samples)[i];
+        }
+    }
+
+    // Converts count samples starting at index into dst
+    void copyTo(size_t index, size_t count, float* dst) const {
+        switch (format) {
+            case UInt16: convert(static_cast<const uint16_t*>(samples) + index, count, dst); break;
+            case UInt8: convert(static_cast<const uint8_t*>(samples) + index, count, dst); break;
+            default: std::memcpy(dst, static_cast<const float*>(samples) + index, count * sizeof(float)); break;
+        }
+    }
+
+    // Returns count samples starting at index as floats, converted into scratch
+    // (at least count floats) unless the map already stores floats.
+    const float* read(size_t index, size_t count, float* scratch) const {
+        if (format == Float32) return static_cast<const float*>(samples) + index;
+        copyTo(index, count, scratch);
+        return scratch;
+    }
+
+    const float* row(uint32_t y, float* scratch) const {
+        return read(static_cast<size_t>(y) * width, width, scratch);
+    }
+
+    // -1..1 normalized value of sample i for the given range, computed on demand
+    float normalized(size_t i, float lo, float hi) const {
+        return hi > lo ? 2.0f * (at(i) - lo) / (hi - lo) - 1.0f : at(i);
+    }
+
+    uint32_t width = 0, height = 0;
+    Format format = Float32;
+    float scale = 1.0f, offset = 0.0f;  // Integer formats only
+
+private:
+    std::shared_ptr<void> owner;
+    void* samples = nullptr;
+
+    template <typename T>
+    void convert(const T* src, size_t count, float* dst) const {
+        for (size_t i = 0; i < count; i++) dst[i] = src[i] * scale + offset;
+    }
+};
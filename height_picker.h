@@ -0,0 +1,160 @@
+#pragma once
+
+#include "height_map.h"
+#include "height_pyramid.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Sample of the surface found by a ray cast
+struct SurfaceHit {
+    uint32_t col = 0, row = 0;
+    float z = 0.0f;         // Unscaled height of the sample
+    glm::vec3 position;     // World position of the hit
+};
+
+// Queries against the displayed surface in the renderer's world layout (the grid
+// spans -5..5 in X and Y, Z is scaled by zScale).
+//
+// Ray casts use the min/max bounds HeightPyramid keeps for every block as a
+// quadtree: blocks whose bounds the ray misses are skipped with all their
+// samples, so a pick visits O(log n) blocks on typical views. Each base sample
+// is treated as a flat square centred on its grid position.
+class HeightPicker {
+public:
+    // Nearest sample hit by the ray, if any. pyramid must be built from base.
+    static bool pick(const HeightMap& base, const HeightPyramid& pyramid, float zScale, const glm::vec3& origin,
+                     const glm::vec3& direction, SurfaceHit& hit) {
+        if (base.empty()) return false;
+        Caster caster{base, pyramid, zScale, origin,
+                      glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z)};
+        return caster.cast(direction, hit);
+    }
+
+    // Heights along the segment from (x0, y0) to (x1, y1) in grid coordinates,
+    // bilinearly interpolated at one point per sample along the longer axis
+    static void profile(const HeightMap& map, float x0, float y0, float x1, float y1, std::vector<float>& out) {
+        out.clear();
+        if (map.empty()) return;
+        size_t count = static_cast<size_t>(std::max(std::abs(x1 - x0), std::abs(y1 - y0))) + 1;
+        out.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            float t = count > 1 ? static_cast<float>(i) / (count - 1) : 0.0f;
+            out[i] = interpolate(map, x0 + (x1 - x0) * t, y0 + (y1 - y0) * t);
+        }
+    }
+
+    static float interpolate(const HeightMap& map, float x, float y) {
+        x = std::max(0.0f, std::min(x, static_cast<float>(map.width - 1)));
+        y = std::max(0.0f, std::min(y, static_cast<float>(map.height - 1)));
+        uint32_t ix = std::min(static_cast<uint32_t>(x), map.width > 1 ? map.width - 2 : 0);
+        uint32_t iy = std::min(static_cast<uint32_t>(y), map.height > 1 ? map.height - 2 : 0);
+        uint32_t jx = std::min(ix + 1, map.width - 1), jy = std::min(iy + 1, map.height - 1);
+        float fx = x - ix, fy = y - iy;
+        size_t row0 = static_cast<size_t>(iy) * map.width, row1 = static_cast<size_t>(jy) * map.width;
+        float top = map.at(row0 + ix) * (1.0f - fx) + map.at(row0 + jx) * fx;
+        float bottom = map.at(row1 + ix) * (1.0f - fx) + map.at(row1 + jx) * fx;
+        return top * (1.0f - fy) + bottom * fy;
+    }
+
+    // World position of a grid position at height z (unscaled)
+    static glm::vec3 toWorld(float col, float row, float z, uint32_t width, uint32_t height, float zScale) {
+        return glm::vec3((col - width / 2.0f) * (10.0f / width), (row - height / 2.0f) * (10.0f / height), z * zScale);
+    }
+
+private:
+    struct Node {
+        int level;  // Pyramid level, or -1 for a base sample
+        uint32_t x, y;
+        float t;    // Where the ray enters the node's bounds
+    };
+
+    struct Caster {
+        const HeightMap& base;
+        const HeightPyramid& pyramid;
+        float zScale;
+        glm::vec3 origin;
+        glm::vec3 inverse;  // 1 / direction
+
+        bool cast(const glm::vec3& direction, SurfaceHit& hit) {
+            int top = static_cast<int>(pyramid.levelCount()) - 1;
+            uint32_t w = top < 0 ? base.width : pyramid.level(top).width;
+            uint32_t h = top < 0 ? base.height : pyramid.level(top).height;
+            std::vector<Node> stack;
+            for (uint32_t y = 0; y < h; y++) {
+                for (uint32_t x = 0; x < w; x++) push(top, x, y, stack);
+            }
+            // Nearest nodes are popped first
+            std::sort(stack.begin(), stack.end(), [](const Node& a, const Node& b) { return a.t > b.t; });
+
+            float best = std::numeric_limits<float>::infinity();
+            Node found{};
+            while (!stack.empty()) {
+                Node node = stack.back();
+                stack.pop_back();
+                if (node.t >= best) continue;
+                if (node.level < 0) {
+                    best = node.t;
+                    found = node;
+                    continue;
+                }
+                // Children of a level sample: its 2x2 block one level down
+                int child = node.level - 1;
+                uint32_t cw = child < 0 ? base.width : pyramid.level(child).width;
+                uint32_t ch = child < 0 ? base.height : pyramid.level(child).height;
+                size_t first = stack.size();
+                for (uint32_t y = 2 * node.y; y < std::min(2 * node.y + 2, ch); y++) {
+                    for (uint32_t x = 2 * node.x; x < std::min(2 * node.x + 2, cw); x++) push(child, x, y, stack);
+                }
+                std::sort(stack.begin() + first, stack.end(), [](const Node& a, const Node& b) { return a.t > b.t; });
+            }
+            if (best == std::numeric_limits<float>::infinity()) return false;
+            hit.col = found.x;
+            hit.row = found.y;
+            hit.z = base.at(static_cast<size_t>(found.y) * base.width + found.x);
+            hit.position = origin + direction * best;
+            return true;
+        }
+
+        // Pushes the node if the ray enters its bounds
+        void push(int level, uint32_t x, uint32_t y, std::vector<Node>& stack) {
+            uint32_t factor = level < 0 ? 1 : pyramid.level(level).factor;
+            float c0 = static_cast<float>(x) * factor - 0.5f;
+            float r0 = static_cast<float>(y) * factor - 0.5f;
+            float c1 = std::min(static_cast<float>(x + 1) * factor, static_cast<float>(base.width)) - 0.5f;
+            float r1 = std::min(static_cast<float>(y + 1) * factor, static_cast<float>(base.height)) - 0.5f;
+            float lo, hi;
+            if (level < 0) {
+                lo = hi = base.at(static_cast<size_t>(y) * base.width + x);
+                if (!std::isfinite(lo)) return;
+            } else {
+                const HeightPyramid::Level& l = pyramid.level(level);
+                size_t i = static_cast<size_t>(y) * l.width + x;
+                lo = l.lo[i];
+                hi = l.hi[i];
+            }
+            glm::vec3 a = toWorld(c0, r0, lo, base.width, base.height, zScale);
+            glm::vec3 b = toWorld(c1, r1, hi, base.width, base.height, zScale);
+            float t;
+            if (enters(glm::min(a, b), glm::max(a, b), t)) stack.push_back(Node{level, x, y, t});
+        }
+
+        // Slab test; t is where the ray enters the box (0 if it starts inside)
+        bool enters(const glm::vec3& lo, const glm::vec3& hi, float& t) const {
+            float tMin = 0.0f, tMax = std::numeric_limits<float>::infinity();
+            for (int axis = 0; axis < 3; axis++) {
+                float t0 = (lo[axis] - origin[axis]) * inverse[axis];
+                float t1 = (hi[axis] - origin[axis]) * inverse[axis];
+                if (t0 > t1) std::swap(t0, t1);
+                tMin = std::max(tMin, t0);
+                tMax = std::min(tMax, t1);
+                if (tMin > tMax) return false;
+            }
+            t = tMin;
+            return true;
+        }
+    };
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "height_map.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Mip-style pyramid of a height map. Each level halves the previous one in X and
+// Y (rounding up) and stores the mean of every 2x2 block for display, plus the
+// block minimum and maximum so coarse levels still bound the full-resolution data.
+// Invalid (NaN/inf) samples are left out of all three, so dropouts do not spread
+// to coarser levels; a block is NaN only when none of its samples is valid.
+// The base grid itself is not copied; level(0) is the first decimated level.
+// Levels are either built in memory or adopted from a mapped cache file. Built
+// levels can be shared with another holder, such as a cache file writer.
+class HeightPyramid {
+public:
+    struct Level {
+        uint32_t width = 0, height = 0;
+        uint32_t factor = 1;  // Base samples per level sample along each axis
+        const float* mean = nullptr;
+        const float* lo = nullptr;
+        const float* hi = nullptr;
+
+        size_t size() const { return static_cast<size_t>(width) * height; }
+    };
+
+    HeightPyramid() = default;
+    HeightPyramid(HeightPyramid&&) = default;
+    HeightPyramid& operator=(HeightPyramid&&) = default;
+    // Levels point into storage, so copies would dangle
+    HeightPyramid(const HeightPyramid&) = delete;
+    HeightPyramid& operator=(const HeightPyramid&) = delete;
+
+    // Builds levels until both dimensions are at most minSize
+    void build(const HeightMap& base, uint32_t minSize = 64) {
+        ScopedTimer timer("LOD pyramid");
+        mapping.reset();
+        shared.reset();
+        size_t count = 0;
+        uint32_t w = base.width, h = base.height;
+        uint32_t factor = 1;
+        while (w > minSize || h > minSize) {
+            if (levels.size() <= count) levels.emplace_back();
+            if (storage.size() <= count) storage.emplace_back();
+            Level& level = levels[count];
+            factor *= 2;
+            reduce(count == 0 ? &base : nullptr, count == 0 ? nullptr : &levels[count - 1], w, h, level, storage[count]);
+            level.factor = factor;
+            w = level.width;
+            h = level.height;
+            count++;
+        }
+        levels.resize(count);
+        storage.resize(count);
+    }
+
+    // Recomputes only the level samples reduced from rect after base changed
+    // there, so editing a small region costs time proportional to its size.
+    // Mapped levels are read-only and levels of another size are stale, so
+    // those are rebuilt instead.
+    void update(const HeightMap& base, const GridRect& rect) {
+        if (mapped() || shared || levels.empty() || levels[0].width != (base.width + 1) / 2 ||
+            levels[0].height != (base.height + 1) / 2) {
+            build(base);
+            return;
+        }
+        ScopedTimer timer("LOD pyramid");
+        GridRect region = rect;
+        uint32_t w = base.width, h = base.height;
+        for (size_t i = 0; i < levels.size(); i++) {
+            region = region.halved();
+            reduceRegion(i == 0 ? &base : nullptr, i == 0 ? nullptr : &levels[i - 1], w, h, levels[i], storage[i],
+                         region);
+            w = levels[i].width;
+            h = levels[i].height;
+        }
+    }
+
+    // Uses levels whose samples are kept alive by owner instead of building them
+    void adopt(const std::vector<Level>& external, std::shared_ptr<void> owner) {
+        levels = external;
+        storage.clear();
+        mapping = std::move(owner);
+    }
+
+    void clear() {
+        levels.clear();
+        storage.clear();
+        mapping.reset();
+        shared.reset();
+    }
+
+    // Keeps the current levels alive for as long as the returned pointer is
+    // held, even after this pyramid is rebuilt or cleared. Built levels move
+    // into shared storage without a copy; the next build() allocates afresh.
+    std::shared_ptr<void> share() {
+        if (mapping) return mapping;
+        if (!shared) {
+            shared = std::make_shared<std::vector<Storage>>(std::move(storage));
+            storage.clear();
+        }
+        return shared;
+    }
+
+    size_t levelCount() const { return levels.size(); }
+    const Level& level(size_t i) const { return levels[i]; }
+
+    // Bytes of all levels, whether built or mapped
+    size_t bytes() const {
+        size_t total = 0;
+        for (const auto& level : levels) total += 3 * level.size() * sizeof(float);
+        return total;
+    }
+
+    bool mapped() const { return mapping != nullptr; }
+
+private:
+    struct Storage {
+        std::vector<float> mean, lo, hi;
+    };
+
+    std::vector<Level> levels;
+    std::vector<Storage> storage;  // Backs levels when built in memory
+    std::shared_ptr<void> mapping;  // Backs levels when adopted
+    std::shared_ptr<std::vector<Storage>> shared;  // Backs levels after share()
+
+    // Reduces either the base map (whose samples are their own min/max) or the previous level
+    static void reduce(const HeightMap* base, const Level* prev, uint32_t w, uint32_t h, Level& out, Storage& data) {
+        out.width = (w + 1) / 2;
+        out.height = (h + 1) / 2;
+        size_t count = static_cast<size_t>(out.width) * out.height;
+        data.mean.resize(count);
+        data.lo.resize(count);
+        data.hi.resize(count);
+        out.mean = data.mean.data();
+        out.lo = data.lo.data();
+        out.hi = data.hi.data();
+        reduceRegion(base, prev, w, h, out, data, GridRect{0, 0, out.width, out.height});
+    }
+
+    // Recomputes the samples of out inside rect (in out's coordinates)
+    static void reduceRegion(const HeightMap* base, const Level* prev, uint32_t w, uint32_t h, const Level& out,
+                             Storage& data, const GridRect& rect) {
+        float* mean = data.mean.data();
+        float* lo = data.lo.data();
+        float* hi = data.hi.data();
+
+        uint32_t outWidth = out.width;
+        parallelFor(rect.height(), chunkCount(rect.size()), [&](size_t, size_t begin, size_t end) {
+            std::vector<float> scratch(base ? 2 * static_cast<size_t>(w) : 0);
+            for (size_t y = rect.y0 + begin; y < rect.y0 + end; y++) {
+                uint32_t y0 = static_cast<uint32_t>(2 * y);
+                uint32_t y1 = std::min(y0 + 1, h - 1);
+                const float *mean0, *mean1, *lo0, *lo1, *hi0, *hi1;
+                if (base) {
+                    mean0 = lo0 = hi0 = base->row(y0, scratch.data());
+                    mean1 = lo1 = hi1 = base->row(y1, scratch.data() + w);
+                } else {
+                    mean0 = prev->mean + static_cast<size_t>(y0) * w;
+                    mean1 = prev->mean + static_cast<size_t>(y1) * w;
+                    lo0 = prev->lo + static_cast<size_t>(y0) * w;
+                    lo1 = prev->lo + static_cast<size_t>(y1) * w;
+                    hi0 = prev->hi + static_cast<size_t>(y0) * w;
+                    hi1 = prev->hi + static_cast<size_t>(y1) * w;
+                }
+                for (uint32_t x = rect.x0; x < rect.x1; x++) {
+                    uint32_t x0 = 2 * x;
+                    uint32_t x1 = std::min(x0 + 1, w - 1);
+                    // Edge blocks on odd sizes repeat the last row/column, so they average real samples only.
+                    // A previous level's lo/hi are valid exactly where its mean is.
+                    float sum = 0.0f, valid = 0.0f;
+                    float blockLo = std::numeric_limits<float>::infinity(), blockHi = -blockLo;
+                    auto add = [&](const float* m, const float* l, const float* u, uint32_t at) {
+                        bool finite = std::isfinite(m[at]);
+                        sum += finite ? m[at] : 0.0f;
+                        valid += finite ? 1.0f : 0.0f;
+                        blockLo = finite ? std::min(blockLo, l[at]) : blockLo;
+                        blockHi = finite ? std::max(blockHi, u[at]) : blockHi;
+                    };
+                    add(mean0, lo0, hi0, x0);
+                    add(mean0, lo0, hi0, x1);
+                    add(mean1, lo1, hi1, x0);
+                    add(mean1, lo1, hi1, x1);
+                    size_t i = y * outWidth + x;
+                    const float nan = std::numeric_limits<float>::quiet_NaN();
+                    mean[i] = valid > 0.0f ? sum / valid : nan;
+                    lo[i] = valid > 0.0f ? blockLo : nan;
+                    hi[i] = valid > 0.0f ? blockHi : nan;
+                }
+            }
+        });
+    }
+};
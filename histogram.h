@@ -0,0 +1,86 @@
+#pragma once
+
+#include "height_map.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Z value histogram built with one pass over the data. Each thread fills private
+// bins that are merged at the end; within a thread, bin indices are computed a
+// block at a time in a branch-free loop the compiler can vectorize, and only the
+// increments are scattered.
+class Histogram {
+public:
+    void compute(const HeightMap& map, float lo, float hi, int binCount) {
+        ScopedTimer timer("Histogram");
+        size_t count = map.size();
+        binCount = std::max(1, binCount);
+        rangeMin = lo;
+        rangeMax = hi;
+        counts.assign(binCount, 0);
+        outside = 0;
+
+        size_t chunks = chunkCount(count);
+        // One extra slot per thread collects NaN and out-of-range samples
+        std::vector<std::vector<uint64_t>> partial(chunks, std::vector<uint64_t>(binCount + 1, 0));
+        float scale = hi > lo ? binCount / (hi - lo) : 0.0f;
+        float binsF = static_cast<float>(binCount);
+        int lastBin = binCount - 1;
+
+        parallelFor(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+            uint64_t* bins = partial[chunk].data();
+            const size_t block = 4096;
+            int index[block];
+            float scratch[block];  // Used only for integer storage
+            for (size_t start = begin; start < end; start += block) {
+                size_t n = std::min(block, end - start);
+                const float* z = map.read(start, n, scratch);
+                for (size_t i = 0; i < n; i++) {
+                    float v = (z[i] - lo) * scale;
+                    index[i] = (v >= 0.0f && v <= binsF) ? std::min(static_cast<int>(v), lastBin) : binCount;
+                }
+                for (size_t i = 0; i < n; i++) bins[index[i]]++;
+            }
+        });
+
+        for (const auto& bins : partial) {
+            for (int b = 0; b < binCount; b++) counts[b] += bins[b];
+            outside += bins[binCount];
+        }
+
+        normalize();
+    }
+
+    // Restores counts computed earlier, e.g. read from a cache file
+    void assign(const uint64_t* binCounts, int binCount, uint64_t outsideCount, float lo, float hi) {
+        counts.assign(binCounts, binCounts + binCount);
+        outside = outsideCount;
+        rangeMin = lo;
+        rangeMax = hi;
+        normalize();
+    }
+
+    int bins() const { return static_cast<int>(counts.size()); }
+    const std::vector<uint64_t>& binCounts() const { return counts; }
+    const std::vector<float>& normalized() const { return normalizedCounts; }
+    uint64_t outsideCount() const { return outside; }
+    float min() const { return rangeMin; }
+    float max() const { return rangeMax; }
+
+private:
+    std::vector<uint64_t> counts;
+    std::vector<float> normalizedCounts;
+    uint64_t outside = 0;
+    float rangeMin = 0.0f, rangeMax = 0.0f;
+
+    // Normalized to 0-1 for plotting
+    void normalize() {
+        uint64_t maxCount = counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+        normalizedCounts.resize(counts.size());
+        for (size_t b = 0; b < counts.size(); b++) {
+            normalizedCounts[b] = maxCount > 0 ? static_cast<float>(counts[b]) / maxCount : 0.0f;
+        }
+    }
+};
@@ -0,0 +1,378 @@
+#pragma once
+
+#include "filter_pipeline.h"
+#include "profiler.h"
+#include "scan_cache.h"
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A scan picked up by LiveFolder, decoded and optionally filtered, with the
+// time it spent in each stage
+struct LiveScan {
+    std::string name;                         // File name within the folder
+    std::shared_ptr<const DecodedScan> scan;
+    std::vector<float> filtered;              // Empty when filtering is off
+    SurfaceStats filteredStats;               // Of filtered
+    PowerSpectrum spectrum;                   // PSD of filtered, if asked for
+    int64_t closedUs = 0;                     // Profiler::nowUs() when the writer closed the file
+    double settleMs = 0.0, decodeMs = 0.0, filterMs = 0.0;
+    size_t skipped = 0;                       // Older scans dropped for this one so far
+};
+
+// Watches a folder for new TIFFs with inotify and prepares them for display on
+// background threads, so the viewer can follow an instrument that writes scans
+// continuously.
+//
+// A file counts as complete once its writer closed it (or it was renamed into
+// the folder) and no further event arrived for the settle time, its size did
+// not change meanwhile and its TIFF header reads back. Complete files go
+// through decode and filter stages on separate threads, so the next scan
+// decodes while the previous one filters and the one before that uploads on
+// the UI thread. Each stage only keeps the newest scan: when files arrive
+// faster than they can be shown, older ones are skipped rather than queued.
+// Decoded scans go through the ScanCache, so opening them later is instant.
+class LiveFolder {
+public:
+    explicit LiveFolder(ScanCache& cache) : scanCache(cache) {}
+
+    ~LiveFolder() { stop(); }
+
+    LiveFolder(const LiveFolder&) = delete;
+    LiveFolder& operator=(const LiveFolder&) = delete;
+
+    bool start(const std::string& path, std::string& error) {
+        stop();
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0) {
+            error = std::string("inotify unavailable: ") + std::strerror(errno);
+            return false;
+        }
+        if (inotify_add_watch(inotifyFd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY) < 0) {
+            error = "Failed to watch " + path + ": " + std::strerror(errno);
+            close(inotifyFd);
+            inotifyFd = -1;
+            return false;
+        }
+        if (pipe(wakePipe) != 0) {
+            error = std::string("Failed to create wake pipe: ") + std::strerror(errno);
+            close(inotifyFd);
+            inotifyFd = -1;
+            return false;
+        }
+        folder = path;
+        stopping = false;
+        settling = hasComplete = hasDecoded = hasResult = false;
+        skipped = 0;
+        watchThread = std::thread(&LiveFolder::watch, this);
+        decodeThread = std::thread(&LiveFolder::decodeLoop, this);
+        filterThread = std::thread(&LiveFolder::filterLoop, this);
+        return true;
+    }
+
+    void stop() {
+        if (inotifyFd < 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        char byte = 0;
+        if (write(wakePipe[1], &byte, 1) < 0) std::cerr << "Failed to wake folder watcher" << std::endl;
+        watchThread.join();
+        decodeThread.join();
+        filterThread.join();
+        close(inotifyFd);
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        inotifyFd = -1;
+    }
+
+    bool active() const { return inotifyFd >= 0; }
+    const std::string& path() const { return folder; }
+
+    // Applies to scans decoded after the call
+    void setNativePrecision(bool enabled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        nativePrecision = enabled;
+    }
+
+    // Quiet time after the last write event before a closed file is read
+    void setSettleTime(int ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        settleUs = static_cast<int64_t>(std::max(0, ms)) * 1000;
+    }
+
+    // Stages run on each new scan; an empty list shows scans unfiltered. Bandpass
+    // stages take each scan's raw Z range as cutoffs, as the viewer does on load.
+    void setFilter(const std::vector<FilterStage>& list, FftEngine::PlannerEffort effort,
+                   BandpassFilter::Padding padding, BandpassFilter::Window window) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stages = list;
+        plannerEffort = effort;
+        edgePadding = padding;
+        edgeWindow = window;
+    }
+
+    // Rings of the PSD computed for each filtered scan; 0 (the default) skips it
+    void setSpectrumBins(size_t bins) {
+        std::lock_guard<std::mutex> lock(mutex);
+        spectrumBins = bins;
+    }
+
+    // Called from the background threads when a new file starts settling and when
+    // a scan is ready, so a UI that sleeps between frames can wake up
+    void setNotify(std::function<void()> fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        notify = std::move(fn);
+    }
+
+    // Takes the newest scan ready for display
+    bool take(LiveScan& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!hasResult) return false;
+        out = std::move(result);
+        hasResult = false;
+        return true;
+    }
+
+    // A scan is between its close event and take()
+    bool busy() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return settling || hasComplete || decoding || hasDecoded || filtering || hasResult;
+    }
+
+private:
+    // A file seen by inotify that has not settled yet
+    struct Candidate {
+        int64_t closedUs = -1;     // Last close or move-in event, -1 while only modified
+        int64_t lastEventUs = 0;
+        int64_t size = -1;         // At the last event
+    };
+
+    ScanCache& scanCache;
+    std::string folder;
+    int inotifyFd = -1;
+    int wakePipe[2] = {-1, -1};
+    std::thread watchThread, decodeThread, filterThread;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    bool nativePrecision = false;
+    int64_t settleUs = 200000;
+    std::vector<FilterStage> stages;
+    FftEngine::PlannerEffort plannerEffort = FftEngine::Measure;
+    BandpassFilter::Padding edgePadding = BandpassFilter::MirrorPadding;
+    BandpassFilter::Window edgeWindow = BandpassFilter::NoWindow;
+    size_t spectrumBins = 0;
+    std::map<std::string, Candidate> waiting;  // Watch thread only
+    bool settling = false;                     // waiting is not empty
+    LiveScan complete, decoded, result;         // Newest scan handed to each stage
+    bool hasComplete = false, hasDecoded = false, hasResult = false;
+    bool decoding = false, filtering = false;
+    size_t skipped = 0;
+    std::function<void()> notify;
+
+    static bool isTiff(const std::string& name) {
+        auto endsWith = [&name](const char* suffix) {
+            size_t n = std::strlen(suffix);
+            return name.size() > n && name.compare(name.size() - n, n, suffix) == 0;
+        };
+        return endsWith(".tif") || endsWith(".tiff");
+    }
+
+    static int64_t fileSize(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? static_cast<int64_t>(st.st_size) : -1;
+    }
+
+    // Reads inotify events and promotes settled files to the decode stage
+    void watch() {
+        std::vector<char> buffer(64 * (sizeof(inotify_event) + NAME_MAX + 1));
+        while (true) {
+            int64_t settle;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) return;
+                settle = settleUs;
+            }
+
+            // Sleep until an event arrives or the earliest closed file settles
+            int timeout = -1;
+            int64_t now = Profiler::nowUs();
+            for (const auto& kv : waiting) {
+                if (kv.second.closedUs < 0) continue;
+                int64_t due = (kv.second.lastEventUs + settle - now + 999) / 1000;
+                timeout = timeout < 0 ? static_cast<int>(std::max<int64_t>(0, due))
+                                      : std::min(timeout, static_cast<int>(std::max<int64_t>(0, due)));
+            }
+            pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+            if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+                std::cerr << "Folder watch failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            if (fds[1].revents & POLLIN) return;
+
+            if (fds[0].revents & POLLIN) {
+                ssize_t length;
+                while ((length = read(inotifyFd, buffer.data(), buffer.size())) > 0) {
+                    int64_t eventUs = Profiler::nowUs();
+                    for (ssize_t offset = 0; offset < length;) {
+                        const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+                        offset += sizeof(inotify_event) + event->len;
+                        if (event->len == 0 || (event->mask & IN_ISDIR)) continue;
+                        std::string name = event->name;
+                        if (!isTiff(name)) continue;
+                        Candidate& candidate = waiting[name];
+                        candidate.lastEventUs = eventUs;
+                        candidate.size = fileSize(folder + "/" + name);
+                        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) candidate.closedUs = eventUs;
+                    }
+                }
+            }
+
+            now = Profiler::nowUs();
+            for (auto it = waiting.begin(); it != waiting.end();) {
+                const Candidate& candidate = it->second;
+                if (candidate.closedUs < 0 || now - candidate.lastEventUs < settle) {
+                    ++it;
+                    continue;
+                }
+                std::string path = folder + "/" + it->first;
+                TiffInfo info;
+                std::string error;
+                if (fileSize(path) != candidate.size) {
+                    // Still growing without events (e.g. a network share); wait another settle period
+                    it->second.lastEventUs = now;
+                    it->second.size = fileSize(path);
+                    ++it;
+                    continue;
+                }
+                if (!TiffDecoder::readInfo(path, info, error)) {
+                    // A later close event brings it back
+                    std::cerr << "Live: skipping " << it->first << ": " << error << std::endl;
+                    it = waiting.erase(it);
+                    continue;
+                }
+                LiveScan scan;
+                scan.name = it->first;
+                scan.closedUs = candidate.closedUs;
+                scan.settleMs = (now - candidate.closedUs) / 1000.0;
+                it = waiting.erase(it);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (hasComplete) skipped++;
+                    complete = std::move(scan);
+                    hasComplete = true;
+                }
+                wake.notify_all();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            bool started = !settling && !waiting.empty();
+            settling = !waiting.empty();
+            if (started && notify) notify();
+        }
+    }
+
+    void decodeLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || hasComplete; });
+            if (stopping) return;
+            LiveScan scan = std::move(complete);
+            hasComplete = false;
+            decoding = true;
+            bool native = nativePrecision;
+            lock.unlock();
+
+            int64_t start = Profiler::nowUs();
+            scan.scan = scanCache.load(folder + "/" + scan.name, native);
+            scan.decodeMs = (Profiler::nowUs() - start) / 1000.0;
+            Profiler::instance().record("Live decode", start, Profiler::nowUs() - start);
+
+            lock.lock();
+            decoding = false;
+            if (!scan.scan->ok) {
+                std::cerr << "Live: " << scan.scan->error << ": " << scan.name << std::endl;
+                continue;
+            }
+            if (hasDecoded) skipped++;
+            decoded = std::move(scan);
+            hasDecoded = true;
+            wake.notify_all();
+        }
+    }
+
+    // The pipeline persists across scans, so FFT plans and buffers are reused
+    // while the instrument keeps its resolution
+    void filterLoop() {
+        FilterPipeline pipeline;
+        FftEngine::PlannerEffort effort = FftEngine::Measure;
+        BandpassFilter::Padding padding = BandpassFilter::MirrorPadding;
+        BandpassFilter::Window window = BandpassFilter::NoWindow;
+        pipeline.setPlannerEffort(effort);
+        pipeline.setEdgeHandling(padding, window);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || hasDecoded; });
+            if (stopping) return;
+            LiveScan scan = std::move(decoded);
+            hasDecoded = false;
+            filtering = true;
+            std::vector<FilterStage> list = stages;
+            pipeline.setSpectrumBins(spectrumBins);
+            if (plannerEffort != effort) pipeline.setPlannerEffort(effort = plannerEffort);
+            if (edgePadding != padding || edgeWindow != window) {
+                pipeline.setEdgeHandling(padding = edgePadding, window = edgeWindow);
+            }
+            lock.unlock();
+
+            if (!list.empty()) {
+                int64_t start = Profiler::nowUs();
+                for (auto& stage : list) {
+                    if (stage.type != FilterStage::Bandpass) continue;
+                    stage.low = scan.scan->stats.min;
+                    stage.high = scan.scan->stats.max;
+                }
+                pipeline.setInput(scan.scan->map);
+                pipeline.setStages(list);
+                if (pipeline.run()) {
+                    scan.filteredStats = pipeline.outputStats();
+                    pipeline.outputSpectrum(scan.spectrum);
+                    pipeline.takeOutput(scan.filtered);
+                } else {
+                    std::cerr << "Live: filter failed for " << scan.name << ", showing it unfiltered" << std::endl;
+                }
+                // Earlier stage buffers and FFT plans stay allocated for the next scan
+                pipeline.setInput(HeightMap());
+                scan.filterMs = (Profiler::nowUs() - start) / 1000.0;
+                Profiler::instance().record("Live filter", start, Profiler::nowUs() - start);
+            }
+
+            lock.lock();
+            filtering = false;
+            if (hasResult) skipped++;
+            scan.skipped = skipped;
+            result = std::move(scan);
+            hasResult = true;
+            if (notify) notify();
+        }
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <GL/glew.h>
+#ifdef SCAN_VIEWER_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// OpenGL context without a window, for rendering on machines with no display.
+//
+// By default the context comes from EGL on Mesa's surfaceless platform, which
+// works with GPU drivers and with the llvmpipe software rasterizer alike. Build
+// with -DSCAN_VIEWER_OSMESA (and -lOSMesa instead of -lEGL) to use OSMesa where
+// EGL is not available. Either way drawing goes to a framebuffer object of the
+// requested size, read back with readPixels().
+class OffscreenContext {
+public:
+    ~OffscreenContext() { destroy(); }
+
+    OffscreenContext() = default;
+    OffscreenContext(const OffscreenContext&) = delete;
+    OffscreenContext& operator=(const OffscreenContext&) = delete;
+
+    bool create(int w, int h, std::string& error) {
+        width = w;
+        height = h;
+        if (!createContext(error)) {
+            destroy();
+            return false;
+        }
+        // GLEW reports a missing GLX display after loading the GL entry points
+        // when the context is not from GLX; the functions are usable regardless
+        glewExperimental = GL_TRUE;
+        GLenum glew = glewInit();
+        if (glew != GLEW_OK && glew != GLEW_ERROR_NO_GLX_DISPLAY) {
+            error = "Failed to initialize GLEW";
+            destroy();
+            return false;
+        }
+        glGetError();
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            error = "Offscreen framebuffer is incomplete";
+            destroy();
+            return false;
+        }
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    void destroy() {
+        if (framebuffer) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorBuffer);
+            glDeleteRenderbuffers(1, &depthBuffer);
+            framebuffer = colorBuffer = depthBuffer = 0;
+        }
+#ifdef SCAN_VIEWER_OSMESA
+        if (context) OSMesaDestroyContext(context);
+        context = nullptr;
+#else
+        if (display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+            eglTerminate(display);
+        }
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    // Name of the GL implementation, e.g. to tell llvmpipe from a GPU in benchmark logs
+    std::string renderer() const {
+        const GLubyte* name = glGetString(GL_RENDERER);
+        return name ? reinterpret_cast<const char*>(name) : "unknown";
+    }
+
+    // Reads the framebuffer as RGBA rows, top row first
+    void readPixels(std::vector<uint8_t>& rgba) const {
+        size_t rowBytes = static_cast<size_t>(width) * 4;
+        rgba.resize(rowBytes * height);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        // GL rows start at the bottom
+        std::vector<uint8_t> row(rowBytes);
+        for (int y = 0; y < height / 2; y++) {
+            uint8_t* top = rgba.data() + rowBytes * y;
+            uint8_t* bottom = rgba.data() + rowBytes * (height - 1 - y);
+            std::memcpy(row.data(), top, rowBytes);
+            std::memcpy(top, bottom, rowBytes);
+            std::memcpy(bottom, row.data(), rowBytes);
+        }
+    }
+
+    int width = 0, height = 0;
+
+private:
+    GLuint framebuffer = 0, colorBuffer = 0, depthBuffer = 0;
+#ifdef SCAN_VIEWER_OSMESA
+    OSMesaContext context = nullptr;
+    std::vector<uint8_t> osmesaBuffer;  // Default framebuffer, unused since drawing goes to the FBO
+
+    bool createContext(std::string& error) {
+        context = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, nullptr);
+        if (!context) {
+            error = "Failed to create OSMesa context";
+            return false;
+        }
+        osmesaBuffer.resize(static_cast<size_t>(width) * height * 4);
+        if (!OSMesaMakeCurrent(context, osmesaBuffer.data(), GL_UNSIGNED_BYTE, width, height)) {
+            error = "Failed to make OSMesa context current";
+            return false;
+        }
+        return true;
+    }
+#else
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+
+    bool createContext(std::string& error) {
+        auto getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        }
+        if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major = 0, minor = 0;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+            display = EGL_NO_DISPLAY;
+            error = "Failed to initialize EGL";
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            error = "EGL does not support desktop OpenGL";
+            return false;
+        }
+        const EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &configs) || configs == 0) {
+            error = "No EGL config for OpenGL";
+            return false;
+        }
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+        if (context == EGL_NO_CONTEXT) {
+            error = "Failed to create EGL context";
+            return false;
+        }
+        // Needs EGL_KHR_surfaceless_context; all drawing goes to the FBO
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            error = "Failed to make EGL context current without a surface";
+            return false;
+        }
+        return true;
+    }
+#endif
+};
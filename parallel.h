@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline unsigned hardwareThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Number of chunks to split count items into so that every chunk has at least
+// minChunk items and there are no more chunks than hardware threads.
+inline size_t chunkCount(size_t count, size_t minChunk = 1 << 16) {
+    size_t byWork = std::max<size_t>(1, count / std::max<size_t>(1, minChunk));
+    return std::min<size_t>(byWork, hardwareThreads());
+}
+
+// Runs fn(chunk, begin, end) for contiguous ranges covering [0, count). Chunk 0
+// runs on the calling thread; the call returns once every chunk has finished.
+template <typename Fn>
+void parallelFor(size_t count, size_t chunks, Fn fn) {
+    if (count == 0) return;
+    chunks = std::max<size_t>(1, std::min(chunks, count));
+    size_t step = (count + chunks - 1) / chunks;
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    for (size_t c = 1; c < chunks; c++) {
+        size_t begin = c * step;
+        size_t end = std::min(count, begin + step);
+        if (begin >= end) break;
+        workers.emplace_back([&fn, c, begin, end] { fn(c, begin, end); });
+    }
+    fn(size_t(0), size_t(0), std::min(count, step));
+    for (auto& t : workers) t.join();
+}
+
+// Fixed set of worker threads consuming a FIFO task queue. Tasks must not wait on
+// other tasks of the same pool, or a saturated pool can deadlock.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = hardwareThreads()) {
+        threads = std::max(1u, threads);
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename Fn>
+    std::future<void> submit(Fn fn) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(fn));
+        std::future<void> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([task] { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // Runs fn(i) for i in [0, count) on the pool and waits for all of them
+    template <typename Fn>
+    void run(size_t count, Fn fn) {
+        std::vector<std::future<void>> pending;
+        pending.reserve(count);
+        for (size_t i = 0; i < count; i++) pending.push_back(submit([&fn, i] { fn(i); }));
+        for (auto& f : pending) f.get();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <zlib.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes 8-bit RGBA images as PNG using zlib for the image data
+class PngWriter {
+public:
+    // rgba holds width*height pixels, top row first
+    static bool write(const std::string& path, const uint8_t* rgba, uint32_t width, uint32_t height,
+                      std::string& error, int level = 6) {
+        // Each row is prefixed with its filter type; "up" filtering compresses the
+        // smooth color gradients of rendered surfaces well
+        size_t rowBytes = static_cast<size_t>(width) * 4;
+        std::vector<uint8_t> filtered((rowBytes + 1) * height);
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t* out = filtered.data() + (rowBytes + 1) * y;
+            const uint8_t* row = rgba + rowBytes * y;
+            out[0] = y == 0 ? 0 : 2;
+            for (size_t i = 0; i < rowBytes; i++) {
+                out[1 + i] = y == 0 ? row[i] : static_cast<uint8_t>(row[i] - row[i - rowBytes]);
+            }
+        }
+        uLongf compressedBytes = compressBound(static_cast<uLong>(filtered.size()));
+        std::vector<uint8_t> compressed(compressedBytes);
+        if (compress2(compressed.data(), &compressedBytes, filtered.data(), static_cast<uLong>(filtered.size()),
+                      level) != Z_OK) {
+            error = "Failed to compress image";
+            return false;
+        }
+        compressed.resize(compressedBytes);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            error = "Failed to create " + path;
+            return false;
+        }
+        static const uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+        std::vector<uint8_t> header;
+        putBigEndian(header, width);
+        putBigEndian(header, height);
+        header.insert(header.end(), {8, 6, 0, 0, 0});  // 8 bits, RGBA, deflate, no interlace
+        writeChunk(out, "IHDR", header);
+        writeChunk(out, "IDAT", compressed);
+        writeChunk(out, "IEND", {});
+        out.close();
+        if (!out) {
+            error = "Failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static void putBigEndian(std::vector<uint8_t>& bytes, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) bytes.push_back(static_cast<uint8_t>(value >> shift));
+    }
+
+    static void writeChunk(std::ofstream& out, const char type[4], const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> head;
+        putBigEndian(head, static_cast<uint32_t>(data.size()));
+        head.insert(head.end(), type, type + 4);
+        uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(type), 4);
+        if (!data.empty()) crc = crc32(crc, data.data(), static_cast<uInt>(data.size()));
+        std::vector<uint8_t> tail;
+        putBigEndian(tail, static_cast<uint32_t>(crc));
+        out.write(reinterpret_cast<const char*>(head.data()), head.size());
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        out.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+    }
+};
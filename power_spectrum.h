@@ -0,0 +1,103 @@
+#pragma once
+
+#include "fft_engine.h"
+#include "height_map.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "surface_stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Radially averaged power spectral density of a height map: the mean of
+// |F|^2 / N over rings of equal spatial frequency, from DC (excluded) up to the
+// Nyquist frequency of 0.5 cycles per sample. Corners of the spectrum beyond
+// Nyquist along the diagonal are left out so every ring is complete.
+struct PowerSpectrum {
+    std::vector<float> frequency;  // Ring centres in cycles per sample
+    std::vector<float> power;      // Mean power per ring
+
+    bool empty() const { return power.empty(); }
+
+    // Averages the half spectrum of an r2c transform over a gridWidth x gridHeight grid
+    static PowerSpectrum radial(const fftwf_complex* spectrum, uint32_t gridWidth, uint32_t gridHeight, size_t bins) {
+        ScopedTimer timer("PSD");
+        PowerSpectrum psd;
+        if (!spectrum || gridWidth == 0 || gridHeight == 0 || bins == 0) return psd;
+        uint32_t spectrumWidth = gridWidth / 2 + 1;
+        double norm = 1.0 / (static_cast<double>(gridWidth) * gridHeight);
+        float binWidth = 0.5f / bins;
+
+        // Rows are split across threads; per-chunk ring sums are combined in order
+        size_t chunks = chunkCount(static_cast<size_t>(gridHeight) * spectrumWidth);
+        std::vector<std::vector<double>> sums(chunks, std::vector<double>(bins, 0.0));
+        std::vector<std::vector<uint64_t>> counts(chunks, std::vector<uint64_t>(bins, 0));
+        parallelFor(gridHeight, chunks, [&](size_t chunk, size_t begin, size_t end) {
+            std::vector<double>& sum = sums[chunk];
+            std::vector<uint64_t>& count = counts[chunk];
+            for (size_t y = begin; y < end; y++) {
+                float fy = (y < gridHeight / 2 ? y : static_cast<float>(y) - gridHeight) / static_cast<float>(gridHeight);
+                const fftwf_complex* row = spectrum + y * spectrumWidth;
+                for (uint32_t x = 0; x < spectrumWidth; x++) {
+                    float fx = x / static_cast<float>(gridWidth);
+                    float freq = std::sqrt(fx * fx + fy * fy);
+                    size_t bin = static_cast<size_t>(freq / binWidth);
+                    if ((x == 0 && y == 0) || bin >= bins) continue;
+                    double re = row[x][0], im = row[x][1];
+                    sum[bin] += (re * re + im * im) * norm;
+                    count[bin]++;
+                }
+            }
+        });
+
+        psd.frequency.resize(bins);
+        psd.power.resize(bins);
+        for (size_t b = 0; b < bins; b++) {
+            double sum = 0.0;
+            uint64_t count = 0;
+            for (size_t c = 0; c < chunks; c++) {
+                sum += sums[c][b];
+                count += counts[c][b];
+            }
+            psd.frequency[b] = (b + 0.5f) * binWidth;
+            psd.power[b] = count ? static_cast<float>(sum / count) : 0.0f;
+        }
+        return psd;
+    }
+
+    // Transforms the map with fft, whose plan and buffers are kept for the next
+    // map of the same size. The mean is subtracted, non-finite samples are set to
+    // it and the grid is padded with it to a fast FFT size, so maps of any origin
+    // are normalized the same way.
+    static bool compute(const HeightMap& map, size_t bins, FftEngine& fft, PowerSpectrum& out) {
+        if (map.empty()) return false;
+        double mean = SurfaceStats::compute(map).mean;
+        {
+            ScopedTimer timer("FFT plan");
+            if (!fft.prepare(FftEngine::goodSize(map.width), FftEngine::goodSize(map.height))) return false;
+        }
+        uint32_t gridWidth = fft.gridWidth(), gridHeight = fft.gridHeight();
+        {
+            ScopedTimer timer("FFT forward");
+            float* grid = fft.real();
+            float offset = static_cast<float>(mean);
+            size_t chunks = chunkCount(static_cast<size_t>(gridWidth) * gridHeight);
+            parallelFor(gridHeight, chunks, [&](size_t, size_t begin, size_t end) {
+                for (size_t y = begin; y < end; y++) {
+                    float* dst = grid + y * gridWidth;
+                    if (y >= map.height) {
+                        std::fill(dst, dst + gridWidth, 0.0f);
+                        continue;
+                    }
+                    map.copyTo(y * map.width, map.width, dst);
+                    for (uint32_t x = 0; x < map.width; x++) dst[x] = std::isfinite(dst[x]) ? dst[x] - offset : 0.0f;
+                    std::fill(dst + map.width, dst + gridWidth, 0.0f);
+                }
+            });
+            fft.forward();
+        }
+        out = radial(fft.spectrum(), gridWidth, gridHeight, bins);
+        return true;
+    }
+};
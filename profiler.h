@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide record of timed stages (decode, FFT, histogram, upload, draw...)
+// from any thread. Every stage keeps a rolling window of recent durations for the
+// in-app overlay; with trace recording on, each event is also kept (up to a fixed
+// number, oldest dropped first) for export as a Chrome trace (chrome://tracing,
+// Perfetto) or CSV.
+//
+// Stages are timed with ScopedTimer. Names must be string literals, since events
+// store the pointer.
+class Profiler {
+public:
+    struct Event {
+        const char* name;
+        int thread;       // Small id per thread; 0 is the GPU timeline
+        int64_t startUs;  // Since the profiler was created
+        int64_t durationUs;
+    };
+
+    struct StageStats {
+        double lastMs = 0.0, meanMs = 0.0, maxMs = 0.0;  // Over the rolling window
+        uint64_t count = 0;
+    };
+
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - instance().epoch).count();
+    }
+
+    // Id of the calling thread in recorded events
+    static int threadId() {
+        static std::atomic<int> next{1};
+        thread_local int id = next++;
+        return id;
+    }
+
+    void record(const char* name, int64_t startUs, int64_t durationUs, int thread = threadId()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stage& stage = stages[name];
+        if (stage.window.size() < WindowSize) {
+            stage.window.push_back(static_cast<float>(durationUs / 1000.0));
+        } else {
+            stage.window[stage.count % WindowSize] = static_cast<float>(durationUs / 1000.0);
+        }
+        stage.last = static_cast<float>(durationUs / 1000.0);
+        stage.count++;
+        if (!recording) return;
+        if (events.size() < maxEvents) {
+            events.push_back(Event{name, thread, startUs, durationUs});
+        } else {
+            events[eventStart] = Event{name, thread, startUs, durationUs};
+            eventStart = (eventStart + 1) % events.size();
+        }
+    }
+
+    // Marks the end of a rendered frame; the interval since the previous call is
+    // added to the frame time window
+    void frame() {
+        int64_t now = nowUs();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (lastFrameUs >= 0) {
+            float ms = static_cast<float>((now - lastFrameUs) / 1000.0);
+            if (frameTimes.size() < WindowSize) {
+                frameTimes.push_back(ms);
+            } else {
+                frameTimes[frameCount % WindowSize] = ms;
+            }
+            frameCount++;
+        }
+        lastFrameUs = now;
+    }
+
+    // Starts the next frame interval now, e.g. after the caller slept waiting
+    // for input, so idle time does not show up as a long frame
+    void restartFrame() {
+        int64_t now = nowUs();
+        std::lock_guard<std::mutex> lock(mutex);
+        lastFrameUs = now;
+    }
+
+    // Recent frame times in ms, oldest first
+    std::vector<float> recentFrames() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frameTimes.size() < WindowSize) return frameTimes;
+        std::vector<float> ordered(frameTimes.begin() + frameCount % WindowSize, frameTimes.end());
+        ordered.insert(ordered.end(), frameTimes.begin(), frameTimes.begin() + frameCount % WindowSize);
+        return ordered;
+    }
+
+    // p in [0, 1] of the given times (nearest rank)
+    static float percentile(std::vector<float> times, float p) {
+        if (times.empty()) return 0.0f;
+        size_t rank = static_cast<size_t>(p * (times.size() - 1) + 0.5f);
+        std::nth_element(times.begin(), times.begin() + rank, times.end());
+        return times[rank];
+    }
+
+    std::map<std::string, StageStats> stageStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, StageStats> result;
+        for (const auto& entry : stages) {
+            const Stage& stage = entry.second;
+            StageStats& stats = result[entry.first];
+            stats.lastMs = stage.last;
+            stats.count = stage.count;
+            for (float ms : stage.window) {
+                stats.meanMs += ms;
+                stats.maxMs = std::max(stats.maxMs, static_cast<double>(ms));
+            }
+            if (!stage.window.empty()) stats.meanMs /= stage.window.size();
+        }
+        return result;
+    }
+
+    void setRecording(bool enabled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        recording = enabled;
+    }
+
+    bool isRecording() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return recording;
+    }
+
+    size_t eventCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return events.size();
+    }
+
+    void clearEvents() {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.clear();
+        eventStart = 0;
+    }
+
+    // Chrome trace event format: complete ("X") events in microseconds
+    bool writeChromeTrace(const std::string& path, std::string& error) const {
+        std::vector<Event> ordered = orderedEvents();
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            error = "Failed to create " + path;
+            return false;
+        }
+        out << "{\"traceEvents\":[\n";
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        for (const Event& e : ordered) {
+            out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+                << ",\"ts\":" << e.startUs << ",\"dur\":" << e.durationUs << "}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        out.close();
+        if (!out) {
+            error = "Failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    bool writeCsv(const std::string& path, std::string& error) const {
+        std::vector<Event> ordered = orderedEvents();
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            error = "Failed to create " + path;
+            return false;
+        }
+        out << "stage,thread,start_us,duration_us\n";
+        for (const Event& e : ordered) {
+            out << e.name << "," << e.thread << "," << e.startUs << "," << e.durationUs << "\n";
+        }
+        out.close();
+        if (!out) {
+            error = "Failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static constexpr size_t WindowSize = 240;
+
+    struct Stage {
+        std::vector<float> window;  // Ring of the last WindowSize durations in ms
+        float last = 0.0f;
+        uint64_t count = 0;
+    };
+
+    Clock::time_point epoch = Clock::now();
+    mutable std::mutex mutex;
+    std::map<std::string, Stage> stages;
+    std::vector<float> frameTimes;
+    uint64_t frameCount = 0;
+    int64_t lastFrameUs = -1;
+    bool recording = false;
+    std::vector<Event> events;  // Ring once full; eventStart is the oldest
+    size_t eventStart = 0;
+    size_t maxEvents = 1 << 20;
+
+    std::vector<Event> orderedEvents() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Event> ordered(events.begin() + eventStart, events.end());
+        ordered.insert(ordered.end(), events.begin(), events.begin() + eventStart);
+        return ordered;
+    }
+};
+
+// Records the time from construction to destruction as one event of a stage
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name) : name(name), startUs(Profiler::nowUs()) {}
+    ~ScopedTimer() { Profiler::instance().record(name, startUs, Profiler::nowUs() - startUs); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* name;
+    int64_t startUs;
+};
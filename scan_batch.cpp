@@ -0,0 +1,160 @@
+// Headless batch mode: filters every TIFF in a folder (optional leveling,
+// smoothing and outlier stages, then the bandpass) and writes the
+// filtered maps plus summary.csv with statistics and roughness parameters.
+// Needs no display or GPU.
+
+#include "batch_processor.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <folder> [options]\n"
+              << "  --output <dir>       Output folder (default <folder>/filtered)\n"
+              << "  --low <um>           Low bandpass cutoff in micrometers\n"
+              << "  --high <um>          High bandpass cutoff in micrometers\n"
+              << "                       (without both, each file uses its raw Z range like the viewer)\n"
+              << "  --level <order>      Subtract a least-squares polynomial (0 mean, 1 plane, up to 3)\n"
+              << "  --gaussian <sigma>   Gaussian smoothing, sigma in samples\n"
+              << "  --median <radius>    Median despeckling over a (2r+1)^2 window, radius 1 to 3\n"
+              << "  --clip <k>           Clamp outliers to mean +- k standard deviations\n"
+              << "                       (these stages run before the bandpass, in the order given)\n"
+              << "  --threads <n>        Files processed concurrently (default: cores / 4)\n"
+              << "  --memory-mb <mb>     Memory budget for files in flight (default 4096)\n"
+              << "  --native             Keep 8/16-bit scans at native precision while filtering\n"
+              << "  --planner <effort>   FFT planner effort: estimate, measure or patient\n"
+              << "  --padding <mode>     FFT grid padding: none, mirror (default) or mean\n"
+              << "  --window <window>    Apodization before the FFT: none (default), tukey or hann\n"
+              << "  --deflate            Write Deflate-compressed maps\n"
+              << "  --no-maps            Only write summary.csv\n"
+              << "  --psd <bins>         Also write each file's radially averaged PSD to <name>_psd.csv\n"
+              << "  --trace <file>       Write stage timings as a Chrome trace (.json) or CSV (.csv)\n";
+}
+
+int main(int argc, char** argv) {
+    BatchSettings settings;
+    bool haveLow = false, haveHigh = false;
+    std::string tracePath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--output") {
+            settings.outputFolder = value();
+        } else if (arg == "--low") {
+            settings.lowCutoff = std::strtof(value(), nullptr);
+            haveLow = true;
+        } else if (arg == "--high") {
+            settings.highCutoff = std::strtof(value(), nullptr);
+            haveHigh = true;
+        } else if (arg == "--level" || arg == "--gaussian" || arg == "--median" || arg == "--clip") {
+            FilterStage stage;
+            const char* v = value();
+            if (arg == "--level") {
+                stage.type = FilterStage::Level;
+                stage.order = std::max(0, std::min(std::atoi(v), 3));
+            } else if (arg == "--gaussian") {
+                stage.type = FilterStage::Gaussian;
+                stage.sigma = std::strtof(v, nullptr);
+            } else if (arg == "--median") {
+                stage.type = FilterStage::Median;
+                stage.radius = std::max(1, std::min(std::atoi(v), 3));
+            } else {
+                stage.type = FilterStage::Clip;
+                stage.clipSigma = std::strtof(v, nullptr);
+            }
+            settings.stages.push_back(stage);
+        } else if (arg == "--threads") {
+            settings.threads = static_cast<unsigned>(std::max(0, std::atoi(value())));
+        } else if (arg == "--memory-mb") {
+            settings.memoryBudget = static_cast<size_t>(std::max(64, std::atoi(value()))) << 20;
+        } else if (arg == "--native") {
+            settings.nativePrecision = true;
+        } else if (arg == "--planner") {
+            std::string effort = value();
+            if (effort == "estimate") {
+                settings.plannerEffort = FftEngine::Estimate;
+            } else if (effort == "measure") {
+                settings.plannerEffort = FftEngine::Measure;
+            } else if (effort == "patient") {
+                settings.plannerEffort = FftEngine::Patient;
+            } else {
+                std::cerr << "Unknown planner effort: " << effort << std::endl;
+                return 2;
+            }
+        } else if (arg == "--padding") {
+            std::string mode = value();
+            if (mode == "none") {
+                settings.padding = BandpassFilter::NoPadding;
+            } else if (mode == "mirror") {
+                settings.padding = BandpassFilter::MirrorPadding;
+            } else if (mode == "mean") {
+                settings.padding = BandpassFilter::MeanPadding;
+            } else {
+                std::cerr << "Unknown padding: " << mode << std::endl;
+                return 2;
+            }
+        } else if (arg == "--window") {
+            std::string window = value();
+            if (window == "none") {
+                settings.window = BandpassFilter::NoWindow;
+            } else if (window == "tukey") {
+                settings.window = BandpassFilter::TukeyWindow;
+            } else if (window == "hann") {
+                settings.window = BandpassFilter::HannWindow;
+            } else {
+                std::cerr << "Unknown window: " << window << std::endl;
+                return 2;
+            }
+        } else if (arg == "--deflate") {
+            settings.compression = COMPRESSION_ADOBE_DEFLATE;
+        } else if (arg == "--no-maps") {
+            settings.writeMaps = false;
+        } else if (arg == "--psd") {
+            settings.spectrumBins = static_cast<size_t>(std::max(1, std::atoi(value())));
+        } else if (arg == "--trace") {
+            tracePath = value();
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] != '-' && settings.inputFolder.empty()) {
+            settings.inputFolder = arg;
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (settings.inputFolder.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    if (haveLow != haveHigh) {
+        std::cerr << "--low and --high must be given together" << std::endl;
+        return 2;
+    }
+    settings.bandLimits = haveLow && haveHigh;
+
+    if (!tracePath.empty()) Profiler::instance().setRecording(true);
+    BatchProcessor processor(settings);
+    std::string error;
+    if (!processor.run(error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    if (!tracePath.empty()) {
+        bool csv = tracePath.size() > 4 && tracePath.compare(tracePath.size() - 4, 4, ".csv") == 0;
+        bool written = csv ? Profiler::instance().writeCsv(tracePath, error)
+                           : Profiler::instance().writeChromeTrace(tracePath, error);
+        if (!written) std::cerr << "Error: " << error << std::endl;
+    }
+    size_t failed = processor.failures();
+    std::cout << processor.results().size() << " files in " << processor.elapsedSeconds() << " s, "
+              << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
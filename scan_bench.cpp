@@ -0,0 +1,422 @@
+// Benchmark of the scan pipeline on synthetic height maps. For each size and
+// TIFF encoding it writes a scan, then times TIFF load, normalization to float,
+// histogram, the bandpass filter (FFT forward, mask, inverse) and building the
+// LOD pyramid and tile bounds the vertex buffers are made from. Reports
+// megapixels per second and peak resident memory of each case. Needs no display.
+// --check instead runs regression checks of edge cases on small synthetic maps.
+
+#include "bandpass_filter.h"
+#include "filter_pipeline.h"
+#include "height_map.h"
+#include "height_pyramid.h"
+#include "histogram.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "tiff_decoder.h"
+#include "tiff_writer.h"
+#include "tile_grid.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct BenchCase {
+    uint32_t width, height;
+    int bits;  // 8, 16 or 32 (float)
+};
+
+struct StageTime {
+    const char* name;
+    double ms;
+};
+
+// Default sizes: powers of two next to awkward ones (primes, 2*prime, mixed
+// radix and non-square), from 256 up to maxSize
+static std::vector<std::pair<uint32_t, uint32_t>> defaultSizes(uint32_t maxSize) {
+    const std::pair<uint32_t, uint32_t> all[] = {
+        {256, 256},   {257, 257},   {1000, 1000}, {1024, 1024}, {2039, 2039},  {3000, 2000},
+        {4096, 4096}, {4099, 4093}, {8191, 8191}, {8192, 8192}, {16384, 16384},
+    };
+    std::vector<std::pair<uint32_t, uint32_t>> sizes;
+    for (const auto& size : all) {
+        if (std::max(size.first, size.second) <= maxSize) sizes.push_back(size);
+    }
+    return sizes;
+}
+
+// Tilted, wavy surface with a bump and noise, roughly -60..60 um, quantized in
+// 0.01 um steps for 16-bit and 0.5 um steps for 8-bit encodings
+static HeightMap syntheticScan(const BenchCase& c) {
+    HeightMap map;
+    HeightMap::Format format = c.bits == 8 ? HeightMap::UInt8 : c.bits == 16 ? HeightMap::UInt16 : HeightMap::Float32;
+    map.allocate(c.width, c.height, format);
+    uint8_t* data = static_cast<uint8_t*>(map.mutableData());
+    parallelFor(c.height, chunkCount(c.height, 16), [&](size_t, size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            uint32_t seed = static_cast<uint32_t>(y) * 2654435761u + 1;
+            for (uint32_t x = 0; x < c.width; x++) {
+                float u = static_cast<float>(x) / c.width, v = static_cast<float>(y) / c.height;
+                seed = seed * 1664525u + 1013904223u;
+                float noise = (seed >> 8) / static_cast<float>(1 << 24) - 0.5f;
+                float z = 20.0f * (u - v) + 15.0f * std::sin(40.0f * u) * std::cos(25.0f * v) +
+                          20.0f * std::exp(-((u - 0.3f) * (u - 0.3f) + (v - 0.6f) * (v - 0.6f)) * 50.0f) + noise;
+                size_t i = y * c.width + x;
+                if (c.bits == 8) {
+                    data[i] = static_cast<uint8_t>(std::clamp((z + 64.0f) * 2.0f, 0.0f, 255.0f));
+                } else if (c.bits == 16) {
+                    float q = std::clamp(z * 100.0f + 32768.0f, 0.0f, 65535.0f);
+                    reinterpret_cast<uint16_t*>(data)[i] = static_cast<uint16_t>(q);
+                } else {
+                    reinterpret_cast<float*>(data)[i] = z;
+                }
+            }
+        }
+    });
+    return map;
+}
+
+// Resets the peak resident set size so each case reports its own peak
+static void resetPeakMemory() {
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+}
+
+static size_t peakMemoryBytes() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+    }
+    return 0;
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs one case repeat times and keeps the fastest time of every stage
+static bool runCase(const BenchCase& c, const std::string& dir, int repeat, bool nativePrecision,
+                    std::vector<StageTime>& best, size_t& peakBytes, std::string& error) {
+    std::string path = dir + "/bench_" + std::to_string(c.width) + "x" + std::to_string(c.height) + "_" +
+                       std::to_string(c.bits) + ".tif";
+    {
+        HeightMap scan = syntheticScan(c);
+        if (!TiffWriter::write(path, scan, error)) return false;
+    }
+    resetPeakMemory();
+    best.clear();
+    for (int run = 0; run < repeat; run++) {
+        std::vector<StageTime> times;
+        auto start = std::chrono::steady_clock::now();
+        HeightMap map;
+        TiffInfo info;
+        SampleStats stats;
+        if (!TiffDecoder::decode(path, map, info, stats, error, nativePrecision)) {
+            std::remove(path.c_str());
+            return false;
+        }
+        times.push_back({"load", millisecondsSince(start)});
+
+        // Conversion of stored samples to float micrometers, as done for the FFT input
+        start = std::chrono::steady_clock::now();
+        std::vector<float> normalized(map.size());
+        parallelFor(map.size(), chunkCount(map.size()), [&](size_t, size_t begin, size_t end) {
+            map.copyTo(begin, end - begin, normalized.data() + begin);
+        });
+        times.push_back({"normalize", millisecondsSince(start)});
+        std::vector<float>().swap(normalized);
+
+        start = std::chrono::steady_clock::now();
+        Histogram histogram;
+        histogram.compute(map, stats.min, stats.max, 100);
+        times.push_back({"histogram", millisecondsSince(start)});
+
+        // Same cutoffs the viewer starts with; stage split from the profiler
+        start = std::chrono::steady_clock::now();
+        {
+            BandpassFilter filter;
+            filter.setPlannerEffort(FftEngine::Estimate);
+            filter.setInput(map);
+            std::vector<float> output(map.size());
+            float zMin, zMax;
+            if (!filter.apply(stats.min, stats.max, output.data(), zMin, zMax)) {
+                error = "FFT setup failed";
+                std::remove(path.c_str());
+                return false;
+            }
+        }
+        times.push_back({"filter", millisecondsSince(start)});
+        std::map<std::string, Profiler::StageStats> stages = Profiler::instance().stageStats();
+        times.push_back({"fft fwd", stages["FFT forward"].lastMs});
+        times.push_back({"fft inv", stages["FFT inverse"].lastMs});
+
+        start = std::chrono::steady_clock::now();
+        HeightPyramid pyramid;
+        pyramid.build(map);
+        std::vector<TileGrid> tileGrids(pyramid.levelCount() + 1);
+        tileGrids[0].build(map);
+        for (size_t i = 0; i < pyramid.levelCount(); i++) {
+            const HeightPyramid::Level& level = pyramid.level(i);
+            tileGrids[i + 1].build(level.lo, level.hi, level.width, level.height);
+        }
+        times.push_back({"vertex", millisecondsSince(start)});
+        FftBufferPool::trim();
+
+        if (best.empty()) {
+            best = times;
+        } else {
+            for (size_t i = 0; i < times.size(); i++) best[i].ms = std::min(best[i].ms, times[i].ms);
+        }
+    }
+    peakBytes = peakMemoryBytes();
+    std::remove(path.c_str());
+    return true;
+}
+
+// Whether two results match: same non-finite samples, finite ones within tolerance
+static bool sameSamples(const std::vector<float>& a, const std::vector<float>& b, float tolerance) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::isfinite(a[i]) != std::isfinite(b[i])) return false;
+        if (std::isfinite(a[i]) && std::abs(a[i] - b[i]) > tolerance) return false;
+    }
+    return true;
+}
+
+// Gaussian then bandpass on a map with one NaN: uncheck the bandpass, check it
+// again and drag its cutoff, taking (and freeing) every result as the viewer
+// does. The bandpass used to keep a view of the Gaussian output it was first
+// given, which had been freed meanwhile; run under -fsanitize=address to see it.
+static bool checkPipelineToggle(std::string& error) {
+    HeightMap map = syntheticScan(BenchCase{256, 192, 32});
+    static_cast<float*>(map.mutableData())[1000] = std::numeric_limits<float>::quiet_NaN();
+    FilterStage gaussian, bandpass;
+    gaussian.type = FilterStage::Gaussian;
+    bandpass.low = 0.0f;
+    bandpass.high = 40.0f;
+
+    FilterPipeline pipeline;
+    pipeline.setPlannerEffort(FftEngine::Estimate);
+    pipeline.setInput(map);
+    std::vector<float> result;
+    auto run = [&](const std::vector<FilterStage>& stages) {
+        pipeline.setStages(stages);
+        std::vector<float> taken;
+        if (!pipeline.run()) return false;
+        pipeline.takeOutput(taken);
+        result.swap(taken);  // The previous result is freed, as by FilterWorker::takeResult()
+        return true;
+    };
+    FilterStage unchecked = bandpass;
+    unchecked.enabled = false;
+    FilterStage dragged = bandpass;
+    dragged.high = 20.0f;
+    if (!run({gaussian, bandpass}) || !run({gaussian, unchecked}) || !run({gaussian, bandpass}) ||
+        !run({gaussian, dragged})) {
+        error = "pipeline run failed";
+        return false;
+    }
+
+    FilterPipeline fresh;
+    fresh.setPlannerEffort(FftEngine::Estimate);
+    fresh.setInput(map);
+    fresh.setStages({gaussian, dragged});
+    std::vector<float> expected;
+    if (!fresh.run()) {
+        error = "pipeline run failed";
+        return false;
+    }
+    fresh.takeOutput(expected);
+    if (!sameSamples(result, expected, 1e-3f)) {
+        error = "result differs from a pipeline run from scratch";
+        return false;
+    }
+    return true;
+}
+
+// Pyramid of an odd-sized map with 1% scattered dropouts and one fully invalid
+// block. Every level cell must be NaN exactly when all base samples under it are
+// invalid, and otherwise hold the mean, minimum and maximum of the valid ones.
+static bool checkPyramidDropouts(std::string& error) {
+    const uint32_t w = 301, h = 203;
+    HeightMap map = syntheticScan(BenchCase{w, h, 32});
+    float* z = static_cast<float*>(map.mutableData());
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < map.size(); i++) {
+        seed = seed * 1664525u + 1013904223u;
+        if ((seed >> 8) % 100 == 0) z[i] = std::numeric_limits<float>::quiet_NaN();
+    }
+    for (uint32_t y = 40; y < 56; y++) {
+        for (uint32_t x = 64; x < 80; x++) z[y * w + x] = std::numeric_limits<float>::quiet_NaN();
+    }
+
+    HeightPyramid pyramid;
+    pyramid.build(map, 8);
+    for (size_t l = 0; l < pyramid.levelCount(); l++) {
+        const HeightPyramid::Level& level = pyramid.level(l);
+        for (uint32_t y = 0; y < level.height; y++) {
+            for (uint32_t x = 0; x < level.width; x++) {
+                float lo = std::numeric_limits<float>::infinity(), hi = -lo;
+                for (uint32_t by = y * level.factor; by < std::min(h, (y + 1) * level.factor); by++) {
+                    for (uint32_t bx = x * level.factor; bx < std::min(w, (x + 1) * level.factor); bx++) {
+                        float v = z[by * w + bx];
+                        if (!std::isfinite(v)) continue;
+                        lo = std::min(lo, v);
+                        hi = std::max(hi, v);
+                    }
+                }
+                size_t i = static_cast<size_t>(y) * level.width + x;
+                bool anyValid = lo <= hi;
+                bool ok = anyValid ? level.lo[i] == lo && level.hi[i] == hi && level.mean[i] >= lo - 1e-3f &&
+                                         level.mean[i] <= hi + 1e-3f
+                                   : std::isnan(level.mean[i]) && std::isnan(level.lo[i]) && std::isnan(level.hi[i]);
+                if (!ok) {
+                    error = "level " + std::to_string(l) + " sample " + std::to_string(x) + "," + std::to_string(y) +
+                            (anyValid ? " does not bound its valid samples" : " should be invalid");
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static int runChecks() {
+    struct Check {
+        const char* name;
+        bool (*fn)(std::string&);
+    };
+    const Check checks[] = {
+        {"pipeline toggle", checkPipelineToggle},
+        {"pyramid dropouts", checkPyramidDropouts},
+    };
+    int failed = 0;
+    for (const Check& check : checks) {
+        std::string error;
+        bool ok = check.fn(error);
+        std::cout << check.name << ": " << (ok ? "ok" : "FAILED - " + error) << std::endl;
+        failed += !ok;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --max-size <n>       Largest default size to run (default 4096, up to 16384)\n"
+              << "  --size <w>x<h>       Run this size instead of the defaults (repeatable)\n"
+              << "  --bits <list>        TIFF encodings, comma separated from 8,16,32 (default all)\n"
+              << "  --repeat <n>         Runs per case, fastest time kept (default 3)\n"
+              << "  --native             Load 8/16-bit scans at native precision\n"
+              << "  --dir <folder>       Where scans are written while benchmarking (default /tmp)\n"
+              << "  --csv <file>         Also write the results as CSV\n"
+              << "  --check              Run the regression checks instead of the benchmark\n";
+}
+
+int main(int argc, char** argv) {
+    uint32_t maxSize = 4096;
+    std::vector<std::pair<uint32_t, uint32_t>> sizes;
+    std::vector<int> bits = {8, 16, 32};
+    int repeat = 3;
+    bool nativePrecision = false;
+    std::string dir = "/tmp";
+    std::string csvPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--max-size") {
+            maxSize = static_cast<uint32_t>(std::max(1, std::atoi(value())));
+        } else if (arg == "--size") {
+            unsigned w = 0, h = 0;
+            if (std::sscanf(value(), "%ux%u", &w, &h) != 2 || w == 0 || h == 0) {
+                std::cerr << "Expected --size <width>x<height>" << std::endl;
+                return 2;
+            }
+            sizes.emplace_back(w, h);
+        } else if (arg == "--bits") {
+            bits.clear();
+            std::stringstream list(value());
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                int b = std::atoi(item.c_str());
+                if (b != 8 && b != 16 && b != 32) {
+                    std::cerr << "Unsupported bit depth: " << item << std::endl;
+                    return 2;
+                }
+                bits.push_back(b);
+            }
+        } else if (arg == "--repeat") {
+            repeat = std::max(1, std::atoi(value()));
+        } else if (arg == "--native") {
+            nativePrecision = true;
+        } else if (arg == "--dir") {
+            dir = value();
+        } else if (arg == "--csv") {
+            csvPath = value();
+        } else if (arg == "--check") {
+            return runChecks();
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (sizes.empty()) sizes = defaultSizes(maxSize);
+
+    std::ofstream csv;
+    if (!csvPath.empty()) {
+        csv.open(csvPath, std::ios::trunc);
+        if (!csv) {
+            std::cerr << "Failed to create " << csvPath << std::endl;
+            return 1;
+        }
+        csv << "width,height,bits,stage,ms,mpix_per_s,peak_mb\n";
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    int failed = 0;
+    for (const auto& size : sizes) {
+        for (int b : bits) {
+            BenchCase c{size.first, size.second, b};
+            std::vector<StageTime> times;
+            size_t peakBytes = 0;
+            std::string error;
+            std::cout << c.width << "x" << c.height << " " << std::setw(2) << b << "-bit:";
+            std::cout.flush();
+            if (!runCase(c, dir, repeat, nativePrecision, times, peakBytes, error)) {
+                std::cout << " FAILED - " << error << std::endl;
+                failed++;
+                continue;
+            }
+            double megapixels = static_cast<double>(c.width) * c.height / 1e6;
+            double peakMb = peakBytes / (1024.0 * 1024.0);
+            for (const StageTime& t : times) {
+                double rate = t.ms > 0.0 ? megapixels / (t.ms / 1000.0) : 0.0;
+                std::cout << "  " << t.name << " " << t.ms << " ms (" << rate << " MP/s)";
+                if (csv) {
+                    csv << c.width << "," << c.height << "," << b << "," << t.name << "," << t.ms << "," << rate
+                        << "," << peakMb << "\n";
+                }
+            }
+            std::cout << "  peak " << peakMb << " MB" << std::endl;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
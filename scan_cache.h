@@ -0,0 +1,385 @@
+#pragma once
+
+#include "scan_file.h"
+#include "tiff_decoder.h"
+#include <sys/stat.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A decoded TIFF scan as held by ScanCache
+struct DecodedScan {
+    std::string path;
+    bool nativePrecision = false;
+    int64_t modified = 0, fileSize = 0;  // File stamp at decode time
+    bool ok = false;
+    HeightMap map;
+    TiffInfo info;
+    SampleStats stats;
+    std::string error;
+    double seconds = 0.0;  // Decode time
+    std::shared_ptr<const ScanFile> file;  // Set when read from a native cache file
+
+    bool sameSource(const DecodedScan& other) const {
+        return path == other.path && nativePrecision == other.nativePrecision &&
+               modified == other.modified && fileSize == other.fileSize;
+    }
+
+    // Copy of the fields sameSource() compares, without samples or cache file
+    DecodedScan source() const {
+        DecodedScan key;
+        key.path = path;
+        key.nativePrecision = nativePrecision;
+        key.modified = modified;
+        key.fileSize = fileSize;
+        return key;
+    }
+};
+
+// Memory-bounded LRU cache of decoded scans with a background prefetcher.
+//
+// load() returns a cached scan immediately, waits for a prefetch of the same file
+// that is already running, or decodes on the calling thread. prefetch() replaces
+// the queue of files the worker decodes next, so flipping through a folder keeps
+// the neighbors of the current scan ready. Entries are keyed by path, precision
+// mode and file stamp, so a scan rewritten on disk is decoded again. Entries share
+// their HeightMap buffers with callers; evicting one only frees memory once no
+// caller still holds it.
+//
+// With cache files enabled, a scan is read from its ScanFile beside the TIFF when
+// one matches, and after a TIFF decode the worker writes that file once any
+// prefetches are done. A caller that displays the scan meanwhile can hand over
+// the pyramid and histogram it built, so the writer does not build them again.
+class ScanCache {
+public:
+    explicit ScanCache(size_t budget = size_t(2) << 30) : budgetBytes(budget), thread(&ScanCache::loop, this) {}
+
+    ~ScanCache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    ScanCache(const ScanCache&) = delete;
+    ScanCache& operator=(const ScanCache&) = delete;
+
+    // Failed decodes are returned but not cached. hit is set when no decode was
+    // needed on the calling thread.
+    std::shared_ptr<const DecodedScan> load(const std::string& path, bool nativePrecision, bool* hit = nullptr) {
+        DecodedScan key = makeKey(path, nativePrecision);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (std::shared_ptr<const DecodedScan> scan = findLocked(key)) {
+                if (hit) *hit = true;
+                return scan;
+            }
+            if (!inFlight || !inFlight->sameSource(key)) break;
+            decoded.wait(lock);
+        }
+        if (hit) *hit = false;
+        bool files = useFiles;
+        lock.unlock();
+        std::shared_ptr<DecodedScan> scan = decode(key, files);
+        lock.lock();
+        if (scan->ok) insertLocked(scan);
+        queueWriteLocked(scan);
+        return scan;
+    }
+
+    // Replaces the queue of files to decode in the background, in order
+    void prefetch(const std::vector<std::string>& paths, bool nativePrecision) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.assign(paths.begin(), paths.end());
+            queueNative = nativePrecision;
+        }
+        wake.notify_all();
+    }
+
+    // Shares a pyramid built from scan's samples with its pending cache file
+    // write, if there is one; the pyramid's levels stay valid for the writer
+    void providePyramid(const DecodedScan& scan, HeightPyramid& pyramid) {
+        std::lock_guard<std::mutex> lock(mutex);
+        PendingWrite* write = pendingWriteLocked(scan);
+        if (!write || !write->levels.empty()) return;
+        write->owner = pyramid.share();
+        for (size_t i = 0; i < pyramid.levelCount(); i++) write->levels.push_back(pyramid.level(i));
+    }
+
+    // Copies a histogram of scan's samples into its pending cache file write if
+    // it covers the range and bin count the file stores
+    void provideHistogram(const DecodedScan& scan, const Histogram& histogram) {
+        std::lock_guard<std::mutex> lock(mutex);
+        PendingWrite* write = pendingWriteLocked(scan);
+        if (!write || write->histogram.bins() > 0 || histogram.bins() != fileBins ||
+            histogram.min() != scan.stats.min || histogram.max() != scan.stats.max) {
+            return;
+        }
+        write->histogram = histogram;
+    }
+
+    // Enables reading and writing ScanFiles; bins is the histogram resolution stored
+    void setCacheFiles(bool enabled, int bins) {
+        std::lock_guard<std::mutex> lock(mutex);
+        useFiles = enabled;
+        fileBins = bins;
+    }
+
+    void setBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budgetBytes = bytes;
+        evictLocked();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        totalBytes = 0;
+    }
+
+    size_t budget() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return budgetBytes;
+    }
+
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totalBytes;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    bool prefetching() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return inFlight != nullptr || !queue.empty();
+    }
+
+    bool writingFiles() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !writes.empty() || writing;
+    }
+
+private:
+    // A cache file to write, with what callers already built for it
+    struct PendingWrite {
+        std::shared_ptr<const DecodedScan> scan;
+        std::vector<HeightPyramid::Level> levels;  // Empty until provided
+        std::shared_ptr<void> owner;               // Keeps levels alive
+        Histogram histogram;                       // No bins until provided
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable decoded;
+    std::list<std::shared_ptr<const DecodedScan>> entries;  // Most recently used first
+    size_t totalBytes = 0;
+    size_t budgetBytes;
+    std::deque<std::string> queue;
+    bool queueNative = false;
+    std::shared_ptr<const DecodedScan> inFlight;  // Key of the scan the worker is decoding
+    std::deque<PendingWrite> writes;  // Scans waiting for a cache file
+    bool writing = false;
+    bool useFiles = true;
+    int fileBins = 100;
+    bool stopping = false;
+    std::thread thread;
+
+    static DecodedScan makeKey(const std::string& path, bool nativePrecision) {
+        DecodedScan key;
+        key.path = path;
+        key.nativePrecision = nativePrecision;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            key.modified = static_cast<int64_t>(st.st_mtime);
+            key.fileSize = static_cast<int64_t>(st.st_size);
+        }
+        return key;
+    }
+
+    static std::shared_ptr<DecodedScan> decode(const DecodedScan& key, bool useFiles) {
+        auto scan = std::make_shared<DecodedScan>(key);
+        auto startTime = std::chrono::steady_clock::now();
+        if (useFiles && readFile(*scan)) {
+            scan->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            return scan;
+        }
+        scan->ok = TiffDecoder::decode(key.path, scan->map, scan->info, scan->stats, scan->error, key.nativePrecision);
+        if (!scan->ok) scan->map.clear();
+        scan->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        return scan;
+    }
+
+    // Maps the scan's cache file for its precision mode. Native precision stores
+    // 8/16-bit integer TIFFs as integers and everything else as floats, so a
+    // float file is only accepted there when the TIFF it came from is not one
+    // of those integer formats. For a read-only folder the file beside the scan
+    // is tried after the one in the user cache directory.
+    static bool readFile(DecodedScan& scan) {
+        std::vector<std::string> paths = {ScanFile::pathFor(scan.path, scan.nativePrecision)};
+        std::string beside = ScanFile::besidePathFor(scan.path, scan.nativePrecision);
+        if (paths[0] != beside) paths.push_back(beside);
+        std::vector<HeightMap::Format> formats;
+        if (scan.nativePrecision) formats = {HeightMap::UInt16, HeightMap::UInt8};
+        formats.push_back(HeightMap::Float32);
+        for (const std::string& path : paths) {
+            for (HeightMap::Format format : formats) {
+                auto file = ScanFile::open(path, scan.modified, scan.fileSize, format);
+                if (!file) continue;
+                if (scan.nativePrecision && format == HeightMap::Float32 && nativeInteger(file->info)) break;
+                scan.file = file;
+                scan.map = file->map;
+                scan.info = file->info;
+                scan.stats = file->stats;
+                scan.ok = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool nativeInteger(const TiffInfo& info) {
+        return info.sampleFormat == SAMPLEFORMAT_UINT && info.bitsPerSample <= 16;
+    }
+
+    void queueWriteLocked(const std::shared_ptr<const DecodedScan>& scan) {
+        if (!useFiles || !scan->ok || scan->file) return;
+        PendingWrite write;
+        write.scan = scan;
+        writes.push_back(std::move(write));
+        wake.notify_all();
+    }
+
+    PendingWrite* pendingWriteLocked(const DecodedScan& scan) {
+        for (PendingWrite& write : writes) {
+            if (write.scan.get() == &scan) return &write;
+        }
+        return nullptr;
+    }
+
+    // Stores the samples with the histogram and pyramid the viewer would build,
+    // building whichever was not provided
+    static void writeFile(PendingWrite& write, int bins) {
+        const DecodedScan& scan = *write.scan;
+        if (write.histogram.bins() == 0) write.histogram.compute(scan.map, scan.stats.min, scan.stats.max, bins);
+        HeightPyramid pyramid;
+        if (write.levels.empty()) {
+            pyramid.build(scan.map);
+        } else {
+            pyramid.adopt(write.levels, write.owner);
+        }
+        std::string error;
+        if (!ScanFile::write(ScanFile::pathFor(scan.path, scan.nativePrecision), scan.modified, scan.fileSize,
+                             scan.map, scan.info, scan.stats, write.histogram, pyramid, error)) {
+            std::cerr << "Scan cache file not written: " << error << std::endl;
+        }
+    }
+
+    // Looks up a scan and marks it most recently used. Entries for the same path
+    // with a different precision or stamp are dropped.
+    std::shared_ptr<const DecodedScan> findLocked(const DecodedScan& key) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if ((*it)->path != key.path) continue;
+            if (!(*it)->sameSource(key)) {
+                totalBytes -= (*it)->map.bytes();
+                entries.erase(it);
+                return nullptr;
+            }
+            entries.splice(entries.begin(), entries, it);
+            return entries.front();
+        }
+        return nullptr;
+    }
+
+    void insertLocked(const std::shared_ptr<const DecodedScan>& scan) {
+        size_t bytes = scan->map.bytes();
+        if (bytes > budgetBytes) return;
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if ((*it)->path == scan->path) {
+                totalBytes -= (*it)->map.bytes();
+                entries.erase(it);
+                break;
+            }
+        }
+        entries.push_front(scan);
+        totalBytes += bytes;
+        evictLocked();
+    }
+
+    void evictLocked() {
+        while (totalBytes > budgetBytes && !entries.empty()) {
+            totalBytes -= entries.back()->map.bytes();
+            entries.pop_back();
+        }
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !queue.empty() || !writes.empty(); });
+            if (stopping) break;
+
+            // Cache files are written only when there is nothing to prefetch
+            if (queue.empty()) {
+                PendingWrite write = std::move(writes.front());
+                writes.pop_front();
+                int bins = fileBins;
+                writing = true;
+                lock.unlock();
+                writeFile(write, bins);
+                write = PendingWrite();
+                lock.lock();
+                writing = false;
+                continue;
+            }
+
+            std::string path = queue.front();
+            queue.pop_front();
+            bool nativePrecision = queueNative;
+            size_t budget = budgetBytes;
+            bool files = useFiles;
+            lock.unlock();
+            auto key = std::make_shared<DecodedScan>(makeKey(path, nativePrecision));
+            lock.lock();
+            if (findLocked(*key)) continue;
+            inFlight = key;
+            lock.unlock();
+
+            // Skip scans that could never fit instead of evicting everything for them
+            std::shared_ptr<DecodedScan> scan;
+            TiffInfo info;
+            std::string error;
+            if (TiffDecoder::readInfo(path, info, error) && estimatedBytes(info, nativePrecision) <= budget) {
+                scan = decode(*key, files);
+            }
+
+            lock.lock();
+            if (scan && scan->ok) {
+                insertLocked(scan);
+                queueWriteLocked(scan);
+            }
+            inFlight.reset();
+            decoded.notify_all();
+        }
+        inFlight.reset();
+        decoded.notify_all();
+    }
+
+    static size_t estimatedBytes(const TiffInfo& info, bool nativePrecision) {
+        size_t sampleSize = nativePrecision && nativeInteger(info) ? info.bitsPerSample / 8 : sizeof(float);
+        return static_cast<size_t>(info.width) * info.height * sampleSize;
+    }
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "height_map.h"
+#include "height_pyramid.h"
+#include "histogram.h"
+#include "tiff_decoder.h"
+#include "user_cache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Native cache file written beside a scan after its first decode (or in the
+// user cache directory when the scan's folder is read-only). It holds the
+// samples in their storage format, the decode stats, a histogram and the LOD
+// pyramid, laid out so a later visit can mmap the file and use every array in
+// place: reopening costs page-cache reads instead of a TIFF decode and rebuild.
+//
+// Layout: Header, Header::levelCount LevelEntry records, then 64-byte aligned
+// arrays at the recorded offsets. Native byte order; the magic and version
+// reject files from other builds.
+class ScanFile {
+public:
+    // 2: pyramid levels leave invalid samples out instead of turning NaN
+    static constexpr uint32_t Version = 2;
+
+    // Cache file path for a scan: beside it, or in UserCache when its folder is
+    // not writable. Native precision loads get their own file, so the two modes
+    // neither overwrite each other nor read each other's samples.
+    static std::string pathFor(const std::string& scanPath, bool nativePrecision) {
+        if (UserCache::besideWritable(scanPath)) return besidePathFor(scanPath, nativePrecision);
+        return UserCache::pathFor(scanPath, nativePrecision ? ".native.svcache" : ".svcache");
+    }
+
+    // The cache file beside the scan, which a read-only folder may still hold
+    static std::string besidePathFor(const std::string& scanPath, bool nativePrecision) {
+        return scanPath + (nativePrecision ? ".native.svcache" : ".svcache");
+    }
+
+    // Maps path if it was written for the source file with this mtime/size and
+    // storage format. Returns nullptr if it is missing, stale or invalid.
+    static std::shared_ptr<const ScanFile> open(const std::string& path, int64_t modified, int64_t size,
+                                                HeightMap::Format format) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            ::close(fd);
+            return nullptr;
+        }
+        size_t length = static_cast<size_t>(st.st_size);
+        void* base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) return nullptr;
+        std::shared_ptr<void> mapping(base, [length](void* p) { munmap(p, length); });
+
+        const uint8_t* bytes = static_cast<const uint8_t*>(base);
+        const Header& h = *reinterpret_cast<const Header*>(bytes);
+        if (std::memcmp(h.magic, Magic, sizeof(h.magic)) != 0 || h.version != Version || h.fileBytes != length ||
+            h.sourceModified != modified || h.sourceSize != size || h.format != static_cast<uint32_t>(format) ||
+            sizeof(Header) + h.levelCount * sizeof(LevelEntry) > length) {
+            return nullptr;
+        }
+
+        auto file = std::make_shared<ScanFile>();
+        size_t sampleBytes = static_cast<size_t>(h.width) * h.height * HeightMap::sampleSize(format);
+        if (!inBounds(h.samplesOffset, sampleBytes, length) ||
+            !inBounds(h.histogramOffset, h.histogramBins * sizeof(uint64_t), length)) {
+            return nullptr;
+        }
+        const LevelEntry* entries = reinterpret_cast<const LevelEntry*>(bytes + sizeof(Header));
+        for (uint32_t i = 0; i < h.levelCount; i++) {
+            const LevelEntry& e = entries[i];
+            size_t levelBytes = static_cast<size_t>(e.width) * e.height * sizeof(float);
+            if (!inBounds(e.meanOffset, levelBytes, length) || !inBounds(e.loOffset, levelBytes, length) ||
+                !inBounds(e.hiOffset, levelBytes, length)) {
+                return nullptr;
+            }
+            HeightPyramid::Level level;
+            level.width = e.width;
+            level.height = e.height;
+            level.factor = e.factor;
+            level.mean = reinterpret_cast<const float*>(bytes + e.meanOffset);
+            level.lo = reinterpret_cast<const float*>(bytes + e.loOffset);
+            level.hi = reinterpret_cast<const float*>(bytes + e.hiOffset);
+            file->levels.push_back(level);
+        }
+
+        // The samples are read right away by the GPU upload
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t adviseStart = h.samplesOffset / page * page;
+        madvise(const_cast<uint8_t*>(bytes) + adviseStart, h.samplesOffset - adviseStart + sampleBytes, MADV_WILLNEED);
+
+        file->map = HeightMap::wrap(mapping, bytes + h.samplesOffset, h.width, h.height, format, h.scale, h.offset);
+        file->info.width = h.width;
+        file->info.height = h.height;
+        file->info.bitsPerSample = h.bitsPerSample;
+        file->info.sampleFormat = h.sampleFormat;
+        file->info.compression = h.compression;
+        file->info.tiled = h.tiled != 0;
+        file->info.bigTiff = h.bigTiff != 0;
+        file->info.blockWidth = h.blockWidth;
+        file->info.blockHeight = h.blockHeight;
+        file->info.blockCount = h.blockCount;
+        file->stats.min = h.zMin;
+        file->stats.max = h.zMax;
+        file->stats.invalid = h.invalid;
+        file->histogramBins = h.histogramBins;
+        file->histogramOutside = h.histogramOutside;
+        file->histogramMin = h.histogramMin;
+        file->histogramMax = h.histogramMax;
+        file->histogramCounts = reinterpret_cast<const uint64_t*>(bytes + h.histogramOffset);
+        file->mapping = std::move(mapping);
+        file->length = length;
+        return file;
+    }
+
+    // Writes the cache file through a temporary file and a rename, so readers
+    // never map a partially written file
+    static bool write(const std::string& path, int64_t modified, int64_t size, const HeightMap& map,
+                      const TiffInfo& info, const SampleStats& stats, const Histogram& histogram,
+                      const HeightPyramid& pyramid, std::string& error) {
+        // Cleared as bytes so padding is written as zeros too
+        Header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, Magic, sizeof(h.magic));
+        h.version = Version;
+        h.sourceModified = modified;
+        h.sourceSize = size;
+        h.width = map.width;
+        h.height = map.height;
+        h.format = static_cast<uint32_t>(map.format);
+        h.scale = map.scale;
+        h.offset = map.offset;
+        h.zMin = stats.min;
+        h.zMax = stats.max;
+        h.invalid = stats.invalid;
+        h.bitsPerSample = info.bitsPerSample;
+        h.sampleFormat = info.sampleFormat;
+        h.compression = info.compression;
+        h.tiled = info.tiled;
+        h.bigTiff = info.bigTiff;
+        h.blockWidth = info.blockWidth;
+        h.blockHeight = info.blockHeight;
+        h.blockCount = info.blockCount;
+        h.levelCount = static_cast<uint32_t>(pyramid.levelCount());
+        h.histogramBins = static_cast<uint32_t>(histogram.bins());
+        h.histogramOutside = histogram.outsideCount();
+        h.histogramMin = histogram.min();
+        h.histogramMax = histogram.max();
+
+        // Assign offsets
+        uint64_t cursor = sizeof(Header) + h.levelCount * sizeof(LevelEntry);
+        auto place = [&cursor](size_t bytes) {
+            cursor = (cursor + Alignment - 1) / Alignment * Alignment;
+            uint64_t at = cursor;
+            cursor += bytes;
+            return at;
+        };
+        size_t sampleBytes = map.size() * HeightMap::sampleSize(map.format);
+        h.samplesOffset = place(sampleBytes);
+        h.histogramOffset = place(h.histogramBins * sizeof(uint64_t));
+        std::vector<LevelEntry> entries(h.levelCount);
+        for (uint32_t i = 0; i < h.levelCount; i++) {
+            const HeightPyramid::Level& level = pyramid.level(i);
+            size_t levelBytes = level.size() * sizeof(float);
+            entries[i].width = level.width;
+            entries[i].height = level.height;
+            entries[i].factor = level.factor;
+            entries[i].meanOffset = place(levelBytes);
+            entries[i].loOffset = place(levelBytes);
+            entries[i].hiOffset = place(levelBytes);
+        }
+        h.fileBytes = cursor;
+
+        std::string temp = path + ".tmp";
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            error = "Failed to create " + temp;
+            return false;
+        }
+        uint64_t written = 0;
+        auto emit = [&](uint64_t at, const void* data, size_t bytes) {
+            static const char zeros[Alignment] = {};
+            out.write(zeros, at - written);
+            out.write(static_cast<const char*>(data), bytes);
+            written = at + bytes;
+        };
+        emit(0, &h, sizeof(h));
+        emit(written, entries.data(), entries.size() * sizeof(LevelEntry));
+        emit(h.samplesOffset, map.data(), sampleBytes);
+        emit(h.histogramOffset, histogram.binCounts().data(), h.histogramBins * sizeof(uint64_t));
+        for (uint32_t i = 0; i < h.levelCount; i++) {
+            const HeightPyramid::Level& level = pyramid.level(i);
+            size_t levelBytes = level.size() * sizeof(float);
+            emit(entries[i].meanOffset, level.mean, levelBytes);
+            emit(entries[i].loOffset, level.lo, levelBytes);
+            emit(entries[i].hiOffset, level.hi, levelBytes);
+        }
+        out.close();
+        if (!out || std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::remove(temp.c_str());
+            error = "Failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    HeightMap map;  // Samples in place in the mapping
+    TiffInfo info;
+    SampleStats stats;
+    std::vector<HeightPyramid::Level> levels;
+    std::shared_ptr<void> mapping;
+    size_t length = 0;
+
+    uint32_t histogramBins = 0;
+    uint64_t histogramOutside = 0;
+    float histogramMin = 0.0f, histogramMax = 0.0f;
+    const uint64_t* histogramCounts = nullptr;
+
+private:
+    static constexpr char Magic[8] = {'S', 'V', 'C', 'A', 'C', 'H', 'E', '\0'};
+    static constexpr size_t Alignment = 64;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t format;
+        int64_t sourceModified, sourceSize;
+        uint64_t fileBytes;
+        uint32_t width, height;
+        float scale, offset;
+        float zMin, zMax;
+        uint64_t invalid;
+        uint16_t bitsPerSample, sampleFormat, compression;
+        uint8_t tiled, bigTiff;
+        uint32_t blockWidth, blockHeight, blockCount;
+        uint32_t levelCount;
+        uint64_t samplesOffset;
+        uint64_t histogramOffset;
+        uint32_t histogramBins;
+        float histogramMin, histogramMax;
+        uint32_t reserved;
+        uint64_t histogramOutside;
+    };
+
+    struct LevelEntry {
+        uint32_t width = 0, height = 0, factor = 1, reserved = 0;
+        uint64_t meanOffset = 0, loOffset = 0, hiOffset = 0;
+    };
+
+    static bool inBounds(uint64_t offset, uint64_t bytes, size_t length) {
+        return offset <= length && bytes <= length - offset;
+    }
+};
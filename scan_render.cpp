@@ -0,0 +1,313 @@
+// Offscreen renderer: draws scans exactly like the viewer to PNG files, or
+// replays a camera path and reports frame times. Needs no display; runs on GPU
+// drivers or Mesa's software rasterizer.
+
+#include "camera.h"
+#include "height_pyramid.h"
+#include "offscreen_context.h"
+#include "png_writer.h"
+#include "surface_renderer.h"
+#include "tiff_decoder.h"
+#include "tile_grid.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct RenderSettings {
+    std::vector<std::string> scans;
+    std::string output;          // PNG path for one scan, folder for several
+    int width = 1280, height = 720;
+    Camera camera;
+    float zScale = 1.0f;
+    int colorLUT = 0;
+    bool zRange = false;         // Without an explicit range the scan's Z range is used, like the viewer
+    float zMin = 0.0f, zMax = 0.0f;
+    float lodDetail = 1.0f;
+    bool nativePrecision = false;
+    bool benchmark = false;
+    std::string cameraPath;      // Keyframe file; an orbit around the start camera if empty
+    int frames = 360;
+};
+
+static const char* lutNames[] = {"jet", "viridis", "plasma", "hot", "cool", "turbo"};
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <scan.tif>... [options]\n"
+              << "  --output <path>      PNG file for one scan, folder for several (default <name>.png)\n"
+              << "  --size <w>x<h>       Image size (default 1280x720)\n"
+              << "  --rot-x <deg>  --rot-y <deg>  --zoom <z>  --pan-x <x>  --pan-y <y>\n"
+              << "                       Camera, as in the viewer (defaults 0, 0, 5, 0, 0)\n"
+              << "  --z-scale <s>        Z scale (default 1)\n"
+              << "  --lut <name>         jet, viridis, plasma, hot, cool or turbo\n"
+              << "  --z-range <lo> <hi>  Color range (default the scan's Z range)\n"
+              << "  --lod-detail <d>     Samples per pixel targeted by LOD selection (default 1)\n"
+              << "  --native             Keep 8/16-bit scans at native precision\n"
+              << "  --benchmark          Render a camera path and report frame times\n"
+              << "  --camera-path <file> Keyframes, one 'rotX rotY zoom panX panY' per line (implies --benchmark)\n"
+              << "  --frames <n>         Frames rendered along the path (default 360)\n";
+}
+
+// Reads keyframes; blank lines and lines starting with # are skipped
+static bool readCameraPath(const std::string& path, std::vector<Camera>& keys, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "Failed to open camera path: " + path;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') continue;
+        std::istringstream fields(line);
+        Camera key;
+        if (!(fields >> key.rotX >> key.rotY >> key.zoom >> key.panX >> key.panY)) {
+            error = path + ":" + std::to_string(lineNumber) + ": expected rotX rotY zoom panX panY";
+            return false;
+        }
+        keys.push_back(key);
+    }
+    if (keys.size() < 2) {
+        error = "Camera path needs at least two keyframes";
+        return false;
+    }
+    return true;
+}
+
+// Camera at frame of frames, moving through the keyframes at a constant rate
+static Camera cameraAt(const std::vector<Camera>& keys, int frame, int frames) {
+    float t = frames > 1 ? static_cast<float>(frame) / (frames - 1) * (keys.size() - 1) : 0.0f;
+    size_t key = std::min(static_cast<size_t>(t), keys.size() - 2);
+    return Camera::lerp(keys[key], keys[key + 1], t - key);
+}
+
+class ScanRender {
+public:
+    explicit ScanRender(const RenderSettings& s) : settings(s) {}
+
+    ~ScanRender() { renderer.destroy(); }
+
+    bool init(std::string& error) {
+        if (!context.create(settings.width, settings.height, error)) return false;
+        if (!renderer.init()) {
+            error = "Failed to create shader program";
+            return false;
+        }
+        glPointSize(2.0f);
+        std::cout << "OpenGL renderer: " << context.renderer() << std::endl;
+        return true;
+    }
+
+    bool load(const std::string& path, std::string& error) {
+        TiffInfo info;
+        SampleStats stats;
+        if (!TiffDecoder::decode(path, map, info, stats, error, settings.nativePrecision)) return false;
+        zMin = settings.zRange ? settings.zMin : stats.min;
+        zMax = settings.zRange ? settings.zMax : stats.max;
+
+        renderer.upload(0, map);
+        pyramid.build(map);
+        tileGrids.resize(pyramid.levelCount() + 1);
+        tileGrids[0].build(map);
+        for (size_t i = 0; i < pyramid.levelCount(); i++) {
+            const HeightPyramid::Level& level = pyramid.level(i);
+            renderer.upload(i + 1, level.mean, level.width, level.height);
+            tileGrids[i + 1].build(level.lo, level.hi, level.width, level.height);
+        }
+        renderer.trimLevels(pyramid.levelCount() + 1);
+        return true;
+    }
+
+    // Same steps as a frame of ScanViewer::run(), without the UI
+    void drawFrame(const Camera& camera) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glm::mat4 mvp = camera.projection((float)settings.width / settings.height) * camera.view();
+        size_t level = renderer.levelFor(camera.surfacePixels(settings.height) * settings.lodDetail);
+        if (level < tileGrids.size()) {
+            tileGrids[level].cull(mvp, settings.zScale, drawRanges);
+            renderer.draw(mvp, zMin, zMax, settings.zScale, settings.colorLUT, level, &drawRanges);
+        } else {
+            renderer.draw(mvp, zMin, zMax, settings.zScale, settings.colorLUT, level);
+        }
+    }
+
+    bool snapshot(const std::string& path, std::string& error) {
+        drawFrame(settings.camera);
+        std::vector<uint8_t> rgba;
+        context.readPixels(rgba);
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            error = "OpenGL error " + std::to_string(err);
+            return false;
+        }
+        return PngWriter::write(path, rgba.data(), context.width, context.height, error);
+    }
+
+    // Renders every frame of the path to completion (glFinish) and reports the
+    // distribution of frame times
+    void benchmark(const std::vector<Camera>& keys) {
+        std::vector<double> frameMs;
+        frameMs.reserve(settings.frames);
+        drawFrame(keys.front());  // Warm up shader compilation and buffer residency
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < settings.frames; frame++) {
+            auto frameStart = std::chrono::steady_clock::now();
+            drawFrame(cameraAt(keys, frame, settings.frames));
+            glFinish();
+            frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::sort(frameMs.begin(), frameMs.end());
+        auto percentile = [&](double p) { return frameMs[static_cast<size_t>(p * (frameMs.size() - 1))]; };
+        std::cout << "  " << settings.frames << " frames in " << seconds << " s: " << settings.frames / seconds
+                  << " FPS, frame ms median " << percentile(0.5) << ", p95 " << percentile(0.95) << ", max "
+                  << frameMs.back() << std::endl;
+    }
+
+private:
+    RenderSettings settings;
+    OffscreenContext context;
+    SurfaceRenderer renderer;
+    HeightMap map;
+    HeightPyramid pyramid;
+    std::vector<TileGrid> tileGrids;
+    DrawRanges drawRanges;
+    float zMin = 0.0f, zMax = 0.0f;
+};
+
+static std::string baseName(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    return name.substr(0, name.find_last_of('.'));
+}
+
+int main(int argc, char** argv) {
+    RenderSettings settings;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        auto number = [&]() { return std::strtof(value(), nullptr); };
+        if (arg == "--output") {
+            settings.output = value();
+        } else if (arg == "--size") {
+            if (std::sscanf(value(), "%dx%d", &settings.width, &settings.height) != 2 || settings.width <= 0 ||
+                settings.height <= 0) {
+                std::cerr << "Expected --size <width>x<height>" << std::endl;
+                return 2;
+            }
+        } else if (arg == "--rot-x") {
+            settings.camera.rotX = number();
+        } else if (arg == "--rot-y") {
+            settings.camera.rotY = number();
+        } else if (arg == "--zoom") {
+            settings.camera.zoom = number();
+        } else if (arg == "--pan-x") {
+            settings.camera.panX = number();
+        } else if (arg == "--pan-y") {
+            settings.camera.panY = number();
+        } else if (arg == "--z-scale") {
+            settings.zScale = number();
+        } else if (arg == "--lut") {
+            std::string name = value();
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+            auto it = std::find(std::begin(lutNames), std::end(lutNames), name);
+            if (it == std::end(lutNames)) {
+                std::cerr << "Unknown color LUT: " << name << std::endl;
+                return 2;
+            }
+            settings.colorLUT = static_cast<int>(it - std::begin(lutNames));
+        } else if (arg == "--z-range") {
+            settings.zMin = number();
+            settings.zMax = number();
+            settings.zRange = true;
+        } else if (arg == "--lod-detail") {
+            settings.lodDetail = std::max(0.01f, number());
+        } else if (arg == "--native") {
+            settings.nativePrecision = true;
+        } else if (arg == "--benchmark") {
+            settings.benchmark = true;
+        } else if (arg == "--camera-path") {
+            settings.cameraPath = value();
+            settings.benchmark = true;
+        } else if (arg == "--frames") {
+            settings.frames = std::max(1, std::atoi(value()));
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] != '-') {
+            settings.scans.push_back(arg);
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (settings.scans.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::vector<Camera> keys;
+    std::string error;
+    if (settings.benchmark) {
+        if (!settings.cameraPath.empty()) {
+            if (!readCameraPath(settings.cameraPath, keys, error)) {
+                std::cerr << "Error: " << error << std::endl;
+                return 2;
+            }
+        } else {
+            // One turn around the surface from the start camera
+            Camera end = settings.camera;
+            end.rotY += 360.0f;
+            keys = {settings.camera, end};
+        }
+    }
+
+    ScanRender render(settings);
+    if (!render.init(error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    int failed = 0;
+    for (const std::string& scan : settings.scans) {
+        if (!render.load(scan, error)) {
+            std::cerr << scan << ": " << error << std::endl;
+            failed++;
+            continue;
+        }
+        if (settings.benchmark) {
+            std::cout << scan << ":" << std::endl;
+            render.benchmark(keys);
+            if (settings.output.empty()) continue;
+        }
+        std::string path = baseName(scan) + ".png";
+        if (settings.scans.size() == 1 && !settings.output.empty()) {
+            path = settings.output;
+        } else if (!settings.output.empty()) {
+            path = settings.output + "/" + path;
+        }
+        if (!render.snapshot(path, error)) {
+            std::cerr << scan << ": " << error << std::endl;
+            failed++;
+            continue;
+        }
+        std::cout << "Wrote " << path << std::endl;
+    }
+    return failed == 0 ? 0 : 1;
+}
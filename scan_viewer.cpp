@@ -9,102 +9,219 @@
 #include <vector>
 #include <iostream>
 #include <string>
-#include <tiffio.h>
 #include <dirent.h>
+#include <cstdio>
 #include <cstring>
-#include <fftw3.h>
 #include <algorithm>
 #include <limits>
-
-struct Point3D {
-    float x, y, z;
-};
+#include <chrono>
+#include <cmath>
+#include <list>
+#include <map>
+#include <memory>
+#include <thread>
+#include "camera.h"
+#include "filter_worker.h"
+#include "folder_index.h"
+#include "gpu_timer.h"
+#include "height_picker.h"
+#include "height_pyramid.h"
+#include "histogram.h"
+#include "live_folder.h"
+#include "profiler.h"
+#include "scan_cache.h"
+#include "stack_player.h"
+#include "surface_renderer.h"
+#include "surface_stats.h"
+#include "tiff_decoder.h"
 
 class ScanViewer {
 private:
     GLFWwindow* window;
-    std::vector<Point3D> points;
-    std::vector<float> zMap;       // Current filtered Z map
-    std::vector<float> inputZMap;  // Original input Z map in normalized range
-    std::vector<float> rawZMap;    // Raw Z values from TIFF
+    HeightMap raw;                 // Scan samples, stored once at the precision chosen at load
+    std::vector<float> zMap;       // Filtered Z map; empty until a filter result arrives
+    bool keepNativePrecision = false;  // Store 8/16-bit scans as integers (applies to the next load)
     std::vector<float> filterParams;
     glm::mat4 projection, view, model;
-    float zoom = 5.0f;
-    float rotX = 0.0f, rotY = 0.0f;
-    float panX = 0.0f, panY = 0.0f;
+    Camera camera;
     float zMin = 0.0f, zMax = 0.0f;  // Use raw Z range for coloring
     float zScale = 1.0f;
     float filterLowCutoff = 0.0f, filterHighCutoff = 0.0f;  // Bandpass cutoffs in micrometers
-    GLuint shaderProgram, vao, vbo;
+    SurfaceRenderer renderer;
+    HeightPyramid pyramid;           // Decimated copies of the displayed map for distant views
+    bool autoLod = true;
+    int manualLodLevel = 0;
+    float lodDetail = 1.0f;          // Samples per screen pixel targeted by auto LOD
+    size_t drawnLodLevel = 0;
+    std::vector<TileGrid> tileGrids; // Tile Z bounds for each renderer level
+    bool tileCulling = true;
+    DrawRanges drawRanges;
     bool mouseDragging = false;
     bool panning = false;
     double lastX = 0.0, lastY = 0.0;
     std::string currentDataSource = "Generated sample data";
     char folderPathBuffer[256] = "";
+    std::string selectedFolder;
     std::vector<std::string> tiffFiles;
+    int currentFileIndex = -1;  // Index into tiffFiles of the displayed scan
+    FolderIndex folderIndex;    // Metadata and thumbnails, built in the background
+    std::map<std::string, IndexEntry> indexEntries;
+    uint64_t indexVersion = 0;
+    std::map<std::string, GLuint> thumbnailTextures;
     std::string errorMessage;
     int colorLUT = 0;  // 0: Jet, 1: Viridis, 2: Plasma, 3: Hot, 4: Cool, 5: Turbo
     uint32_t width = 0, height = 0;
-    float inputZMin = -1.0f, inputZMax = 1.0f;  // Normalized range
     float rawZMin = 0.0f, rawZMax = 0.0f;      // Original range
-    bool histogramNeedsUpdate = true;
-
-    const char* vertexShaderSource = R"(
-        #version 130
-        attribute vec3 aPos;
-        uniform mat4 mvp;
-        uniform float zMin;
-        uniform float zMax;
-        uniform float zScale;
-        uniform int colorLUT;
-        varying vec3 vColor;
-        void main() {
-            vec3 scaledPos = vec3(aPos.x, aPos.y, aPos.z * zScale);
-            gl_Position = mvp * vec4(scaledPos, 1.0);
-            float t = clamp((aPos.z - zMin) / (zMax - zMin), 0.0, 1.0);
-            if (colorLUT == 0) {  // Jet (more gradations)
-                if (t < 0.25) vColor = mix(vec3(0,0,1), vec3(0,0.5,1), t/0.25);
-                else if (t < 0.5) vColor = mix(vec3(0,0.5,1), vec3(0,1,1), (t-0.25)/0.25);
-                else if (t < 0.75) vColor = mix(vec3(0,1,1), vec3(1,1,0), (t-0.5)/0.25);
-                else vColor = mix(vec3(1,1,0), vec3(1,0,0), (t-0.75)/0.25);
-            } else if (colorLUT == 1) {  // Viridis (more gradations)
-                if (t < 0.33) vColor = mix(vec3(0.267,0.676,0.997), vec3(0.043,0.141,0.278), t/0.33);
-                else if (t < 0.66) vColor = mix(vec3(0.043,0.141,0.278), vec3(0.5,0.5,0.5), (t-0.33)/0.33);
-                else vColor = mix(vec3(0.5,0.5,0.5), vec3(1,0.9,0), (t-0.66)/0.34);
-            } else if (colorLUT == 2) {  // Plasma
-                vColor = vec3(0.908*t + 0.051, 0.463*t + 0.281, 0.996*t + 0.133);
-            } else if (colorLUT == 3) {  // Hot
-                vColor = vec3(3.0*t, t > 0.33 ? 3.0*(t-0.33) : 0.0, t > 0.66 ? 3.0*(t-0.66) : 0.0);
-            } else if (colorLUT == 4) {  // Cool
-                vColor = vec3(t, 1.0-t, 1.0);
-            } else {  // Turbo
-                float r = 0.1357 + t * (4.5970 - t * (42.8537 - t * (151.0138 - t * (218.7175 - t * 115.2778))));
-                float g = 0.0914 + t * (2.1855 + t * (4.2596 - t * (71.3487 - t * (206.5138 - t * 165.4033))));
-                float b = 0.1066 + t * (5.9399 - t * (49.9290 - t * (171.2617 - t * (258.5662 - t * 136.5015))));
-                vColor = vec3(r, g, b);
-            }
-            vColor = clamp(vColor, 0.0, 1.0);
-        }
-    )";
+    size_t invalidSamples = 0;                 // NaN/inf samples in raw
+    bool histogramNeedsUpdate = true;     // Filtered zMap changed
+    bool rawHistogramNeedsUpdate = true;  // raw changed
+    int histogramBins = 100;
+    Histogram rawHistogram, filteredHistogram;
+    bool filterApplied = false;
+    bool filterInputStale = false;  // raw changed during playback; the worker still has an earlier frame
+    float filteredZMin = 0.0f, filteredZMax = 0.0f;
+
+    // The filter pipeline runs on a background thread that caches every stage's
+    // output and only processes the latest stage list. Bandpass stages take
+    // their cutoffs from the histogram's filter range.
+    FilterWorker filterWorker;
+    std::vector<FilterStage> filterStages = {FilterStage()};
+    int newStageType = FilterStage::Level;
+    int fftPlannerEffort = FftEngine::Measure;
+    int fftPadding = BandpassFilter::MirrorPadding;
+    int fftWindow = BandpassFilter::NoWindow;
+
+    // Region of interest drawn with ctrl + drag. While set, the filter,
+    // statistics and histograms only see the cropped sub-grid, and filter
+    // results rewrite just that part of zMap and of the vertex buffers.
+    GridRect roi;              // Empty when the whole scan is used
+    HeightMap roiRaw;          // raw cropped to roi, the filter input
+    std::vector<float> roiZ;   // Filtered ROI samples
+    GridRect patchedRect;      // Part of zMap that holds filtered samples
+    bool selectingRoi = false;
+    double roiStartX = 0.0, roiStartY = 0.0;  // Cursor position where the selection began
+
+    // Statistics and roughness parameters of the filter input (raw or its ROI
+    // crop) and of the latest filter result, with the result's radially averaged
+    // PSD from the filter worker. Input statistics are computed when first shown,
+    // so stack playback does not pay for them on every frame. The PSD takes an
+    // extra transform, so the workers only compute it while the Roughness
+    // section is open.
+    SurfaceStats inputStats, filteredStats;
+    bool inputStatsValid = false;
+    PowerSpectrum filteredSpectrum;
+    static constexpr size_t SpectrumBins = 128;
+    size_t spectrumBins = 0;  // Asked of the filter worker and live mode
+
+    // Surface queries ray-cast against the pyramid's min/max bounds: the sample
+    // under the cursor, and a two-point measurement (alt + click) with the
+    // height profile between the points
+    bool heightReadout = true;
+    bool hoverValid = false;
+    SurfaceHit hoverHit;
+    int measurePoints = 0;  // Points placed so far, 0 to 2
+    SurfaceHit measureA, measureB;
+    std::vector<float> measureProfile;
+
+    // Decoded scans are cached and the neighbors of the current file prefetched.
+    // Surfaces that were displayed unfiltered keep their GPU buffers, pyramid and
+    // tile bounds for a while, so flipping back to them skips the upload too.
+    // They do not keep the scan itself, whose memory the scan cache accounts for;
+    // the budget covers the GPU levels and the pyramids built in host memory.
+    struct CachedSurface {
+        DecodedScan source;  // Identifying fields only
+        SurfaceRenderer::LevelSet levels;
+        HeightPyramid pyramid;
+        std::vector<TileGrid> tileGrids;
+    };
+    ScanCache scanCache;
+    int scanCacheMegabytes = 2048;
+    bool useScanFiles = true;  // Read and write .svcache files beside scans (or in the user cache)
+    std::shared_ptr<const DecodedScan> currentScan;
+    std::list<CachedSurface> surfaceCache;  // Most recently used first
+    size_t surfaceCacheBudget = size_t(512) << 20;
 
-    const char* fragmentShaderSource = R"(
-        #version 130
-        varying vec3 vColor;
-        void main() {
-            gl_FragColor = vec4(vColor, 1.0);
+    // Live mode follows scans written into the selected folder. They are decoded
+    // and filtered in the background while the previous scan stays on screen.
+    LiveFolder liveFolder{scanCache};
+    bool liveFilter = true;   // Run the filter pipeline on live scans
+    int liveSettleMs = 200;
+    LiveScan liveLast;        // Timings of the last live scan shown
+    double liveUploadMs = 0.0, liveLatencyMs = 0.0;
+    size_t liveShown = 0;
+
+    // Multi-page TIFFs play back as a stack of frames decoded ahead on a worker
+    // and streamed into double-buffered GPU levels
+    StackPlayer stackPlayer;
+    int stackFrame = 0;          // Frame on screen
+    int requestedStackFrame = -1;  // Frame scrubbed to, shown once decoded
+    int stackLookahead = 8;
+    bool stackPlaying = false;
+    bool stackLoop = true;
+    bool stackWaiting = false;   // The due frame was not decoded in time
+    float stackFps = 30.0f;
+    double nextStackFrameTime = 0.0;
+    size_t stackLateFrames = 0;
+
+    // Stage timings from Profiler, shown in an overlay and exported as traces
+    GpuTimer drawTimer{"Draw (GPU)"};
+    bool showPerformance = false;
+    bool recordTrace = false;
+    std::string traceMessage;
+
+    // With idle throttling on, frames are only drawn after input, while
+    // background work or playback is running, and for a few frames after the
+    // scene changed; otherwise the loop blocks in glfwWaitEvents. The cap
+    // bounds the frame rate either way (0 draws as fast as possible).
+    static constexpr int RedrawFrames = 3;  // ImGui needs a few frames to settle after input
+    bool idleThrottling = true;
+    int frameRateCap = 60;
+    int redrawFrames = RedrawFrames;
+    bool wasWorking = false;
+    std::chrono::steady_clock::time_point lastFrameStart;
+    uint64_t surfaceVersion = 0;  // Bumped whenever the GPU surface changes
+
+    // Everything the 3D view depends on; a frame that changes it is followed by
+    // RedrawFrames more
+    struct SceneState {
+        glm::mat4 mvp = glm::mat4(0.0f);
+        float zMin = 0.0f, zMax = 0.0f, zScale = 0.0f;
+        int colorLUT = -1;
+        size_t lodLevel = 0;
+        uint64_t surface = 0;
+
+        bool operator==(const SceneState& o) const {
+            return mvp == o.mvp && zMin == o.zMin && zMax == o.zMax && zScale == o.zScale &&
+                   colorLUT == o.colorLUT && lodLevel == o.lodLevel && surface == o.surface;
         }
-    )";
+        bool operator!=(const SceneState& o) const { return !(*this == o); }
+    };
+    SceneState drawnScene;
 
     static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
         ScanViewer* viewer = static_cast<ScanViewer*>(glfwGetWindowUserPointer(window));
+        viewer->requestRedraw();
         if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !ImGui::GetIO().WantCaptureMouse) {
-            if (mods & GLFW_MOD_SHIFT) {
+            if (mods & GLFW_MOD_ALT) {
+                double x, y;
+                glfwGetCursorPos(window, &x, &y);
+                viewer->addMeasurePoint(x, y);
+            } else if (mods & GLFW_MOD_CONTROL) {
+                viewer->selectingRoi = true;
+                glfwGetCursorPos(window, &viewer->roiStartX, &viewer->roiStartY);
+            } else if (mods & GLFW_MOD_SHIFT) {
                 viewer->panning = true;
             } else {
                 viewer->mouseDragging = true;
             }
             glfwGetCursorPos(window, &viewer->lastX, &viewer->lastY);
         } else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
+            if (viewer->selectingRoi) {
+                viewer->selectingRoi = false;
+                double x, y;
+                glfwGetCursorPos(window, &x, &y);
+                viewer->finishRoiSelection(x, y);
+            }
             viewer->mouseDragging = false;
             viewer->panning = false;
         }
@@ -112,15 +229,16 @@ private:
 
     static void cursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
         ScanViewer* viewer = static_cast<ScanViewer*>(glfwGetWindowUserPointer(window));
+        viewer->requestRedraw();
         if (!ImGui::GetIO().WantCaptureMouse) {
             double dx = xpos - viewer->lastX;
             double dy = ypos - viewer->lastY;
             if (viewer->mouseDragging) {
-                viewer->rotY += static_cast<float>(dx * 0.2);
-                viewer->rotX += static_cast<float>(dy * 0.2);
+                viewer->camera.rotY += static_cast<float>(dx * 0.2);
+                viewer->camera.rotX += static_cast<float>(dy * 0.2);
             } else if (viewer->panning) {
-                viewer->panX += static_cast<float>(dx * 0.01);
-                viewer->panY -= static_cast<float>(dy * 0.01);
+                viewer->camera.panX += static_cast<float>(dx * 0.01);
+                viewer->camera.panY -= static_cast<float>(dy * 0.01);
             }
             viewer->lastX = xpos;
             viewer->lastY = ypos;
@@ -129,237 +247,1125 @@ private:
 
     static void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
         ScanViewer* viewer = static_cast<ScanViewer*>(glfwGetWindowUserPointer(window));
+        viewer->requestRedraw();
         if (!ImGui::GetIO().WantCaptureMouse) {
-            viewer->zoom -= static_cast<float>(yoffset * 0.5);
-            viewer->zoom = glm::clamp(viewer->zoom, 1.0f, 20.0f);
+            viewer->camera.zoom -= static_cast<float>(yoffset * 0.5);
+            viewer->camera.zoom = glm::clamp(viewer->camera.zoom, 1.0f, 20.0f);
         }
     }
 
     bool loadTiffZMap(const std::string& path) {
-        TIFF* tif = TIFFOpen(path.c_str(), "r");
-        if (!tif) {
-            errorMessage = "Failed to open TIFF file: " + path;
+        ScopedTimer timer("Load scan");
+        auto startTime = std::chrono::steady_clock::now();
+        stashSurface();
+        releaseScan();
+        bool cached = false;
+        std::shared_ptr<const DecodedScan> scan = scanCache.load(path, keepNativePrecision, &cached);
+        if (!scan->ok) {
+            errorMessage = scan->error + ": " + path;
             return false;
         }
-
-        uint32_t w, h;
-        uint16_t bitsPerSample, sampleFormat, samplesPerPixel;
-        if (!TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w) || 
-            !TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h) ||
-            !TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSample) ||
-            !TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &sampleFormat) ||
-            !TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel)) {
-            errorMessage = "Failed to read TIFF metadata: " + path;
-            TIFFClose(tif);
-            return false;
+        const TiffInfo& info = scan->info;
+        float zMinVal = scan->stats.min;
+        float zMaxVal = scan->stats.max;
+        bool restored = showScan(scan);
+        stackPlayer.open(path, keepNativePrecision);
+        stackFrame = 0;
+        requestedStackFrame = -1;
+        stackPlaying = false;
+        stackLateFrames = 0;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        if (cached) {
+            std::cout << "Loaded TIFF from cache" << (restored ? " (GPU buffers kept)" : "") << ": " << path
+                      << " in " << seconds * 1000.0 << " ms" << std::endl;
+            return true;
         }
-
-        if (samplesPerPixel != 1) {
-            errorMessage = "Only single-channel TIFFs are supported: " + path;
-            TIFFClose(tif);
-            return false;
+        if (scan->file) {
+            std::cout << "Mapped cache file " << ScanFile::pathFor(path, keepNativePrecision) << ": " << width << "x" << height << " in "
+                      << scan->seconds * 1000.0 << " ms, ready in " << seconds * 1000.0 << " ms" << std::endl;
+            return true;
         }
-
-        width = w;
-        height = h;
-        points.clear();
-        zMap.resize(width * height);
-        inputZMap.resize(width * height);
-        rawZMap.resize(width * height);
-        float xScale = 10.0f / width;
-        float yScale = 10.0f / height;
-        std::vector<char> scanline(TIFFScanlineSize(tif));
-
-        float zMinVal = std::numeric_limits<float>::max();
-        float zMaxVal = std::numeric_limits<float>::lowest();
-
-        for (uint32_t y = 0; y < height; y++) {
-            if (TIFFReadScanline(tif, scanline.data(), y) < 0) {
-                errorMessage = "Failed to read scanline " + std::to_string(y) + " from: " + path;
-                TIFFClose(tif);
-                return false;
-            }
-            for (uint32_t x = 0; x < width; x++) {
-                float z;
-                if (bitsPerSample == 32 && sampleFormat == SAMPLEFORMAT_IEEEFP) {
-                    z = reinterpret_cast<float*>(scanline.data())[x];  // Raw μm
-                } else if (bitsPerSample == 16 && sampleFormat == SAMPLEFORMAT_UINT) {
-                    z = (reinterpret_cast<uint16_t*>(scanline.data())[x] / 65535.0f) * 2.0f - 1.0f;
-                } else if (bitsPerSample == 8 && sampleFormat == SAMPLEFORMAT_UINT) {
-                    z = (reinterpret_cast<uint8_t*>(scanline.data())[x] / 255.0f) * 2.0f - 1.0f;
-                } else {
-                    errorMessage = "Unsupported TIFF format (" + 
-                                  std::to_string(bitsPerSample) + " bits, format " + 
-                                  std::to_string(sampleFormat) + "): " + path;
-                    TIFFClose(tif);
-                    return false;
-                }
-                int idx = y * width + x;
-                rawZMap[idx] = z;
-                zMinVal = std::min(zMinVal, z);
-                zMaxVal = std::max(zMaxVal, z);
-            }
+        seconds = scan->seconds;
+        double megabytes = static_cast<double>(width) * height * (info.bitsPerSample / 8) / (1024.0 * 1024.0);
+        std::cout << "Loaded TIFF: " << width << "x" << height << " (" << raw.size() << " points, " << raw.bytes() / (1024.0 * 1024.0) << " MB stored), Raw Z range: " << zMinVal << " to " << zMaxVal << std::endl;
+        if (invalidSamples == raw.size()) {
+            std::cout << "  No finite samples; every sample is NaN/inf" << std::endl;
+        } else if (invalidSamples > 0) {
+            std::cout << "  " << invalidSamples << " invalid (NaN/inf) samples" << std::endl;
         }
+        std::cout << "  " << (info.tiled ? "tiled" : "stripped") << (info.bigTiff ? " BigTIFF" : "")
+                  << ", compression " << info.compression << ", " << info.blockCount << " blocks, "
+                  << megabytes << " MB in " << seconds * 1000.0 << " ms (" << megabytes / seconds << " MB/s)" << std::endl;
+        return true;
+    }
 
-        // Normalize Z to -1 to 1 range for rendering only
-        float zRange = zMaxVal - zMinVal;
-        if (zRange > 0) {
-            for (size_t i = 0; i < rawZMap.size(); i++) {
-                inputZMap[i] = 2.0f * (rawZMap[i] - zMinVal) / zRange - 1.0f;
-                zMap[i] = rawZMap[i];  // Start with raw values for filtering
-            }
+    // Makes a decoded scan current after releaseScan() and uploads it. A result
+    // filtered off the UI thread (moved out of filtered) is shown instead of the
+    // raw samples. Returns true if the GPU levels came from the surface cache.
+    bool showScan(const std::shared_ptr<const DecodedScan>& scan, LiveScan* filtered = nullptr) {
+        currentScan = scan;
+        raw = scan->map;
+        width = scan->info.width;
+        height = scan->info.height;
+        invalidSamples = scan->stats.invalid;
+        currentDataSource = scan->path;
+        rawZMin = scan->stats.min;
+        rawZMax = scan->stats.max;
+        zMin = rawZMin;
+        zMax = rawZMax;
+        filterLowCutoff = rawZMin;
+        filterHighCutoff = rawZMax;
+
+        bool restored = false;
+        if (filtered && filtered->filtered.size() == raw.size()) {
+            zMap.swap(filtered->filtered);
+            filterApplied = true;
+            patchedRect = GridRect{0, 0, width, height};
+            zMin = filteredZMin = filtered->filteredStats.min;
+            zMax = filteredZMax = filtered->filteredStats.max;
+            filteredStats = filtered->filteredStats;
+            filteredSpectrum = std::move(filtered->spectrum);
+            uploadSurface();
         } else {
-            inputZMap = rawZMap;
-            zMap = rawZMap;
+            restored = restoreSurface(*scan);
+            if (!restored) uploadSurface();
+            surfaceVersion++;
         }
+        setFilterInput();
+        errorMessage.clear();
+        return restored;
+    }
 
-        points.clear();
-        for (uint32_t y = 0; y < height; y++) {
-            for (uint32_t x = 0; x < width; x++) {
-                int idx = y * width + x;
-                float xPos = (x - width/2.0f) * xScale;
-                float yPos = (y - height/2.0f) * yScale;
-                points.push_back({xPos, yPos, rawZMap[idx]});
-            }
+    // Passes the pipeline and FFT settings on to live mode
+    void configureLive() {
+        std::vector<FilterStage> stages;
+        if (liveFilter) stages = filterStages;
+        liveFolder.setFilter(stages, static_cast<FftEngine::PlannerEffort>(fftPlannerEffort),
+                             static_cast<BandpassFilter::Padding>(fftPadding),
+                             static_cast<BandpassFilter::Window>(fftWindow));
+        liveFolder.setNativePrecision(keepNativePrecision);
+        liveFolder.setSettleTime(liveSettleMs);
+    }
+
+    void setLiveMode(bool enabled) {
+        if (!enabled) {
+            liveFolder.stop();
+            return;
         }
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(Point3D), points.data(), GL_STATIC_DRAW);
-        GLenum err = glGetError();
-        if (err != GL_NO_ERROR) {
-            std::cerr << "OpenGL error after loading TIFF: " << err << std::endl;
+        if (selectedFolder.empty()) selectedFolder = folderPathBuffer;
+        if (selectedFolder.empty()) {
+            errorMessage = "Select a folder to watch";
+            return;
         }
+        configureLive();
+        std::string error;
+        if (!liveFolder.start(selectedFolder, error)) {
+            errorMessage = error;
+            return;
+        }
+        updateTiffFiles(selectedFolder);
+    }
 
-        TIFFClose(tif);
-        currentDataSource = path;
-        inputZMin = -1.0f;
-        inputZMax = 1.0f;
-        rawZMin = zMinVal;
-        rawZMax = zMaxVal;
-        zMin = rawZMin;
-        zMax = rawZMax;
-        filterLowCutoff = rawZMin;
-        filterHighCutoff = rawZMax;
-        errorMessage.clear();
-        std::cout << "Loaded TIFF: " << width << "x" << height << " (" << points.size() << " points), Raw Z range: " << zMinVal << " to " << zMaxVal << std::endl;
-        return true;
+    // Shows the newest scan live mode has finished. Only the upload runs here;
+    // until then the previous scan stays on screen.
+    void applyLiveScan() {
+        LiveScan live;
+        if (!liveFolder.take(live)) return;
+        int64_t uploadStart = Profiler::nowUs();
+        stashSurface();
+        releaseScan();
+        stackPlayer.close();
+        currentFileIndex = -1;
+        showScan(live.scan, &live);
+        int64_t shownUs = Profiler::nowUs();
+        Profiler::instance().record("Live upload", uploadStart, shownUs - uploadStart);
+        Profiler::instance().record("Live latency", live.closedUs, shownUs - live.closedUs);
+
+        // New files join the list; the index only reads the files it has not seen
+        auto it = std::lower_bound(tiffFiles.begin(), tiffFiles.end(), live.name);
+        if (it == tiffFiles.end() || *it != live.name) {
+            it = tiffFiles.insert(it, live.name);
+            folderIndex.open(selectedFolder, tiffFiles);
+        }
+        currentFileIndex = static_cast<int>(it - tiffFiles.begin());
+
+        liveUploadMs = (shownUs - uploadStart) / 1000.0;
+        liveLatencyMs = (shownUs - live.closedUs) / 1000.0;
+        liveLast = std::move(live);
+        liveShown++;
+        std::cout << "Live: " << liveLast.name << " shown " << liveLatencyMs << " ms after close (settle "
+                  << liveLast.settleMs << ", decode " << liveLast.decodeMs << ", filter " << liveLast.filterMs
+                  << ", upload " << liveUploadMs << " ms)" << std::endl;
+    }
+
+    void showLiveControls() {
+        bool live = liveFolder.active();
+        if (ImGui::Checkbox("Live", &live)) setLiveMode(live);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Watch the folder and show each new scan once it is completely written");
+        }
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Filter live scans", &liveFilter)) configureLive();
+        if (ImGui::SliderInt("Settle (ms)", &liveSettleMs, 0, 2000)) configureLive();
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Quiet time after a file is closed before it is read");
+        }
+        if (!live) return;
+        ImGui::Text("Watching %s%s", liveFolder.path().c_str(), liveFolder.busy() ? " (new scan in progress)" : "");
+        if (liveShown == 0) return;
+        ImGui::Text("%s: %.0f ms from close to display", liveLast.name.c_str(), liveLatencyMs);
+        ImGui::Text("  settle %.0f, decode %.0f, filter %.0f, upload %.0f ms", liveLast.settleMs, liveLast.decodeMs,
+                    liveLast.filterMs, liveUploadMs);
+        ImGui::Text("  %zu scans shown, %zu skipped", liveShown, liveLast.skipped);
     }
 
     void loadDefaultData() {
+        stashSurface();
+        releaseScan();
+        stackPlayer.close();
+        currentFileIndex = -1;
         width = 101;
         height = 101;
-        points.clear();
-        zMap.resize(width * height);
-        inputZMap.resize(width * height);
-        rawZMap.resize(width * height);
-        for (int i = -50; i <= 50; i++) {
-            for (int j = -50; j <= 50; j++) {
+        invalidSamples = 0;
+        raw.allocate(width, height, HeightMap::Float32);
+        float* rawZ = static_cast<float*>(raw.mutableData());
+        // Rows run along Y and columns along X, matching the renderer's grid layout
+        for (int j = -50; j <= 50; j++) {
+            for (int i = -50; i <= 50; i++) {
                 float x = i * 0.1f;
                 float y = j * 0.1f;
                 float z = sin(x) * cos(y) + sin(sqrt(x*x + y*y)) * 0.5f;
-                int idx = (i + 50) * width + (j + 50);
-                rawZMap[idx] = z;
-                inputZMap[idx] = z;  
-                zMap[idx] = z;
-                points.push_back({x, y, z});
+                int idx = (j + 50) * width + (i + 50);
+                rawZ[idx] = z;
             }
         }
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(Point3D), points.data(), GL_STATIC_DRAW);
-        GLenum err = glGetError();
-        if (err != GL_NO_ERROR) {
-            std::cerr << "OpenGL error after loading default data: " << err << std::endl;
-        }
+        uploadSurface();
         currentDataSource = "Generated sample data";
-        inputZMin = -1.0f;
-        inputZMax = 1.0f;
         rawZMin = -1.0f;
         rawZMax = 1.0f;
         zMin = rawZMin;
         zMax = rawZMax;
         filterLowCutoff = rawZMin;
         filterHighCutoff = rawZMax;
+        setFilterInput();
         errorMessage.clear();
     }
 
-    void applyFourierFilter() {
-        if (rawZMap.empty() || width == 0 || height == 0) return;
+    // Releases the current scan and everything derived from it
+    void releaseScan() {
+        filterWorker.setInput(HeightMap());
+        currentScan.reset();
+        raw.clear();
+        std::vector<float>().swap(zMap);
+        pyramid.clear();
+        filterApplied = false;
+        roi = GridRect();
+        roiRaw.clear();
+        std::vector<float>().swap(roiZ);
+        hoverValid = false;
+        measurePoints = 0;
+        measureProfile.clear();
+    }
 
-        fftw_complex* in = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * width * height);
-        fftw_complex* out = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * width * height);
-        fftw_plan forward = fftw_plan_dft_2d(height, width, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_plan inverse = fftw_plan_dft_2d(height, width, out, in, FFTW_BACKWARD, FFTW_ESTIMATE);
+    // Keeps the displayed surface's GPU levels, pyramid and tile bounds if it shows
+    // an unfiltered cached scan; the renderer is left empty
+    void stashSurface() {
+        if (!currentScan || filterApplied || renderer.levelCount() == 0) return;
+        CachedSurface surface;
+        surface.source = currentScan->source();
+        surface.levels = renderer.detachLevels();
+        surface.pyramid = std::move(pyramid);
+        surface.tileGrids = std::move(tileGrids);
+        pyramid.clear();
+        tileGrids.clear();
+        surfaceCache.push_front(std::move(surface));
 
-        for (size_t i = 0; i < rawZMap.size(); i++) {
-            in[i][0] = rawZMap[i];
-            in[i][1] = 0.0;
+        size_t total = 0;
+        for (auto it = surfaceCache.begin(); it != surfaceCache.end();) {
+            size_t bytes = cachedSurfaceBytes(*it);
+            if (total + bytes > surfaceCacheBudget) {
+                SurfaceRenderer::deleteLevels(it->levels);
+                it = surfaceCache.erase(it);
+            } else {
+                total += bytes;
+                ++it;
+            }
         }
+    }
 
-        fftw_execute(forward);
+    // GPU levels plus the pyramid if it lives in host memory rather than a mapped cache file
+    static size_t cachedSurfaceBytes(const CachedSurface& surface) {
+        return SurfaceRenderer::levelBytes(surface.levels) + (surface.pyramid.mapped() ? 0 : surface.pyramid.bytes());
+    }
 
-        // Use spatial frequency based on physical size
-        float pixelSize = 10.0f / std::max(width, height);  // Assuming 10 units across the image
-        float filterLowFreq = filterLowCutoff / (pixelSize * 1e6f);  // Convert μm to cycles/unit
-        float filterHighFreq = filterHighCutoff / (pixelSize * 1e6f);  // Convert μm to cycles/unit
-        if (filterLowFreq > filterHighFreq) std::swap(filterLowFreq, filterHighFreq);
+    // Attaches a stashed surface for scan, if one from the same file is kept
+    bool restoreSurface(const DecodedScan& scan) {
+        for (auto it = surfaceCache.begin(); it != surfaceCache.end(); ++it) {
+            if (it->source.path != scan.path) continue;
+            bool match = it->source.sameSource(scan);
+            if (match) {
+                renderer.attachLevels(std::move(it->levels));
+                pyramid = std::move(it->pyramid);
+                tileGrids = std::move(it->tileGrids);
+            } else {
+                SurfaceRenderer::deleteLevels(it->levels);
+            }
+            surfaceCache.erase(it);
+            return match;
+        }
+        return false;
+    }
 
-        float nyquist = 0.5f;  // Nyquist frequency (max freq = 0.5 cycles/pixel)
-        float lowCutoffFreq = filterLowFreq * pixelSize;  // Scale to normalized frequency
-        float highCutoffFreq = filterHighFreq * pixelSize;
-        lowCutoffFreq = std::max(0.0f, std::min(lowCutoffFreq, nyquist));
-        highCutoffFreq = std::max(0.0f, std::min(highCutoffFreq, nyquist));
+    void clearSurfaceCache() {
+        for (auto& surface : surfaceCache) SurfaceRenderer::deleteLevels(surface.levels);
+        surfaceCache.clear();
+    }
 
-        for (uint32_t y = 0; y < height; y++) {
-            for (uint32_t x = 0; x < width; x++) {
-                int idx = y * width + x;
-                float fx = (x < width/2 ? x : x - width) / (float)width;
-                float fy = (y < height/2 ? y : y - height) / (float)height;
-                float freq = sqrt(fx * fx + fy * fy);
-                if (freq < lowCutoffFreq || freq > highCutoffFreq) {
-                    out[idx][0] = 0.0;
-                    out[idx][1] = 0.0;
-                }
-            }
+    // Loads tiffFiles[index] and queues its neighbors for prefetching
+    void openFile(int index) {
+        if (index < 0 || index >= static_cast<int>(tiffFiles.size())) return;
+        if (!loadTiffZMap(selectedFolder + "/" + tiffFiles[index])) {
+            loadDefaultData();
+            return;
+        }
+        currentFileIndex = index;
+        std::vector<std::string> neighbors;
+        if (index + 1 < static_cast<int>(tiffFiles.size())) neighbors.push_back(selectedFolder + "/" + tiffFiles[index + 1]);
+        if (index > 0) neighbors.push_back(selectedFolder + "/" + tiffFiles[index - 1]);
+        scanCache.prefetch(neighbors, keepNativePrecision);
+    }
+
+    // The filtered map once a filter has run, otherwise the raw samples in place
+    HeightMap displayMap() const {
+        return filterApplied ? HeightMap::view(zMap.data(), width, height) : raw;
+    }
+
+    // Uploads the displayed map and rebuilds the LOD pyramid from it
+    void uploadSurface() {
+        ScopedTimer timer("Upload surface");
+        surfaceVersion++;
+        HeightMap map = displayMap();
+        renderer.upload(0, map);
+        // Unfiltered scans read from a cache file come with their pyramid
+        if (!filterApplied && currentScan && currentScan->file) {
+            pyramid.adopt(currentScan->file->levels, currentScan->file->mapping);
+        } else {
+            pyramid.build(map);
+            // Saves the scan cache from building it again for the cache file
+            if (!filterApplied && currentScan) scanCache.providePyramid(*currentScan, pyramid);
+        }
+        tileGrids.resize(pyramid.levelCount() + 1);
+        tileGrids[0].build(map);
+        for (size_t i = 0; i < pyramid.levelCount(); i++) {
+            const HeightPyramid::Level& level = pyramid.level(i);
+            renderer.upload(i + 1, level.mean, level.width, level.height);
+            tileGrids[i + 1].build(level.lo, level.hi, level.width, level.height);
+        }
+        renderer.trimLevels(pyramid.levelCount() + 1);
+    }
+
+    // Rewrites rect of the displayed map on the GPU and the pyramid samples and
+    // tile bounds derived from it, leaving the rest of the surface untouched
+    void uploadRegion(const GridRect& rect) {
+        ScopedTimer timer("Upload region");
+        surfaceVersion++;
+        HeightMap map = displayMap();
+        renderer.update(0, map, rect);
+        tileGrids.resize(pyramid.levelCount() + 1);
+        tileGrids[0].update(map, rect);
+        pyramid.update(map, rect);
+        GridRect region = rect;
+        for (size_t i = 0; i < pyramid.levelCount(); i++) {
+            region = region.halved();
+            const HeightPyramid::Level& level = pyramid.level(i);
+            renderer.update(i + 1, HeightMap::view(level.mean, level.width, level.height), region);
+            tileGrids[i + 1].update(level.lo, level.hi, level.width, level.height, region);
+        }
+    }
+
+    // Refreshes the ROI crop of raw and what is computed from the filter input.
+    // The filter worker is only pointed at it by setFilterInput(), which waits
+    // for a running filter to stop.
+    void updateFilterInput() {
+        roiRaw = roi.empty() ? HeightMap() : raw.crop(roi);
+        std::vector<float>().swap(roiZ);
+        inputStatsValid = false;
+        rawHistogramNeedsUpdate = true;
+        histogramNeedsUpdate = true;
+        filterInputStale = true;
+    }
+
+    // Points the filter worker at raw, or at its ROI crop
+    void setFilterInput() {
+        updateFilterInput();
+        filterWorker.setInput(roi.empty() ? raw : roiRaw);
+        filterInputStale = false;
+    }
+
+    // Sends the pipeline with the current bandpass cutoffs to the filter worker,
+    // and to the stack player so playback shows filtered frames. While a stack
+    // plays, its frames arrive filtered and the worker is left alone.
+    void requestFilter() {
+        std::vector<FilterStage> stages = filterStages;
+        for (auto& stage : stages) {
+            if (stage.type != FilterStage::Bandpass) continue;
+            stage.low = filterLowCutoff;
+            stage.high = filterHighCutoff;
         }
+        stackPlayer.setFilter(stages, static_cast<FftEngine::PlannerEffort>(fftPlannerEffort),
+                              static_cast<BandpassFilter::Padding>(fftPadding),
+                              static_cast<BandpassFilter::Window>(fftWindow));
+        configureLive();
+        if (stackPlaying) return;
+        if (filterInputStale) setFilterInput();
+        filterWorker.request(stages);
+    }
 
-        fftw_execute(inverse);
-
-        points.clear();
-        float xScale = 10.0f / width;
-        float yScale = 10.0f / height;
-        float norm = 1.0f / (width * height);
-        float zMinVal = std::numeric_limits<float>::max();
-        float zMaxVal = std::numeric_limits<float>::lowest();
-        for (uint32_t y = 0; y < height; y++) {
-            for (uint32_t x = 0; x < width; x++) {
-                int idx = y * width + x;
-                float z = in[idx][0] * norm;
-                z = std::max(-FLT_MAX/2.0f, std::min(z, FLT_MAX/2.0f));  // Clamp to prevent overflow
-                zMap[idx] = z;
-                float xPos = (x - width/2.0f) * xScale;
-                float yPos = (y - height/2.0f) * yScale;
-                points.push_back({xPos, yPos, z});
-                zMinVal = std::min(zMinVal, z);
-                zMaxVal = std::max(zMaxVal, z);
+    void showPipelineControls(const char* const* stageItems, int stageCount) {
+        bool changed = false;
+        int remove = -1, moveUp = -1;
+        for (size_t i = 0; i < filterStages.size(); i++) {
+            FilterStage& stage = filterStages[i];
+            ImGui::PushID(static_cast<int>(i));
+            changed |= ImGui::Checkbox("##enabled", &stage.enabled);
+            ImGui::SameLine();
+            ImGui::Text("%zu. %s", i + 1, FilterStage::name(stage.type));
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Up") && i > 0) moveUp = static_cast<int>(i);
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Remove")) remove = static_cast<int>(i);
+            switch (stage.type) {
+                case FilterStage::Level:
+                    changed |= ImGui::SliderInt("Order", &stage.order, 0, 3, stage.order == 1 ? "%d (plane)" : "%d");
+                    break;
+                case FilterStage::Gaussian:
+                    changed |= ImGui::SliderFloat("Sigma (samples)", &stage.sigma, 0.5f, 20.0f, "%.1f");
+                    break;
+                case FilterStage::Median:
+                    changed |= ImGui::SliderInt("Radius", &stage.radius, 1, 3);
+                    break;
+                case FilterStage::Clip:
+                    changed |= ImGui::SliderFloat("Std Devs", &stage.clipSigma, 1.0f, 6.0f, "%.1f");
+                    break;
+                default:
+                    ImGui::TextDisabled("Cutoffs from the filter range under Histogram");
+                    break;
             }
+            ImGui::PopID();
+        }
+        if (moveUp > 0) {
+            std::swap(filterStages[moveUp - 1], filterStages[moveUp]);
+            changed = true;
+        }
+        if (remove >= 0) {
+            filterStages.erase(filterStages.begin() + remove);
+            changed = true;
         }
+        ImGui::Combo("##newStage", &newStageType, stageItems, stageCount);
+        ImGui::SameLine();
+        if (ImGui::Button("Add Stage")) {
+            FilterStage stage;
+            stage.type = static_cast<FilterStage::Type>(newStageType);
+            filterStages.push_back(stage);
+            changed = true;
+        }
+        if (changed) requestFilter();
+        if (filterWorker.busy()) {
+            ImGui::ProgressBar(filterWorker.progress(), ImVec2(-1, 0), "Filtering...");
+        }
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(Point3D), points.data(), GL_STATIC_DRAW);
-        GLenum err = glGetError();
-        if (err != GL_NO_ERROR) {
-            std::cerr << "OpenGL error after applying filter: " << err << std::endl;
+    // Selects a region of interest, or the whole scan for an empty rect, and
+    // re-runs the filter on it if one is shown
+    void setRoi(const GridRect& rect) {
+        roi = rect;
+        setFilterInput();
+        if (filterApplied) requestFilter();
+    }
+
+    // World-space ray under a window cursor position
+    bool cursorRay(double cursorX, double cursorY, glm::vec3& origin, glm::vec3& direction) const {
+        int windowWidth, windowHeight;
+        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        if (windowWidth <= 0 || windowHeight <= 0 || width == 0 || height == 0) return false;
+        camera.ray(static_cast<float>(2.0 * cursorX / windowWidth - 1.0), static_cast<float>(1.0 - 2.0 * cursorY / windowHeight),
+                   static_cast<float>(windowWidth) / windowHeight, origin, direction);
+        return true;
+    }
+
+    // Sample of the displayed surface under a window cursor position
+    bool pickSurface(double cursorX, double cursorY, SurfaceHit& hit) const {
+        glm::vec3 origin, direction;
+        if (!cursorRay(cursorX, cursorY, origin, direction)) return false;
+        ScopedTimer timer("Pick");
+        return HeightPicker::pick(displayMap(), pyramid, zScale, origin, direction, hit);
+    }
+
+    // Places the first point of a measurement, or the second one and extracts the profile
+    void addMeasurePoint(double cursorX, double cursorY) {
+        SurfaceHit hit;
+        if (!pickSurface(cursorX, cursorY, hit)) return;
+        if (measurePoints == 1) {
+            measureB = hit;
+            measurePoints = 2;
+        } else {
+            measureA = hit;
+            measurePoints = 1;
         }
+        updateMeasurement();
+    }
 
-        fftw_destroy_plan(forward);
-        fftw_destroy_plan(inverse);
-        fftw_free(in);
-        fftw_free(out);
+    // Re-reads the measured heights and profile after the displayed map changed
+    void updateMeasurement() {
+        measureProfile.clear();
+        if (measurePoints == 0 || raw.empty()) return;
+        HeightMap map = displayMap();
+        measureA.z = map.at(static_cast<size_t>(measureA.row) * width + measureA.col);
+        if (measurePoints < 2) return;
+        measureB.z = map.at(static_cast<size_t>(measureB.row) * width + measureB.col);
+        HeightPicker::profile(map, static_cast<float>(measureA.col), static_cast<float>(measureA.row),
+                              static_cast<float>(measureB.col), static_cast<float>(measureB.row), measureProfile);
+    }
+
+    // Screen position of a world point; false if it is behind the camera
+    static bool worldToScreen(const glm::mat4& mvp, const glm::vec3& world, const ImVec2& size, ImVec2& screen) {
+        glm::vec4 p = mvp * glm::vec4(world.x, world.y, world.z, 1.0f);
+        if (p.w <= 0.0f) return false;
+        screen = ImVec2((p.x / p.w * 0.5f + 0.5f) * size.x, (0.5f - p.y / p.w * 0.5f) * size.y);
+        return true;
+    }
+
+    // Intersects the ray under a window cursor position with the plane at the
+    // middle of the scan's Z range and returns the grid position it hits
+    bool cursorToGrid(double cursorX, double cursorY, float& col, float& row) const {
+        glm::vec3 origin, direction;
+        if (!cursorRay(cursorX, cursorY, origin, direction)) return false;
+        float planeZ = 0.5f * (rawZMin + rawZMax) * zScale;
+        if (std::abs(direction.z) < 1e-6f) return false;
+        float t = (planeZ - origin.z) / direction.z;
+        if (t < 0.0f) return false;
+        glm::vec3 hit = origin + direction * t;
+        col = hit.x * width / 10.0f + width / 2.0f;
+        row = hit.y * height / 10.0f + height / 2.0f;
+        return true;
+    }
+
+    // Turns a ctrl + drag from roiStart to the given cursor position into the
+    // grid rectangle it spans; drags that select less than 2x2 samples are ignored
+    void finishRoiSelection(double cursorX, double cursorY) {
+        float col0, row0, col1, row1;
+        if (!cursorToGrid(roiStartX, roiStartY, col0, row0) || !cursorToGrid(cursorX, cursorY, col1, row1)) return;
+        auto clampTo = [](float v, uint32_t limit) {
+            return static_cast<uint32_t>(std::max(0.0f, std::min(v, static_cast<float>(limit))));
+        };
+        GridRect rect;
+        rect.x0 = clampTo(std::floor(std::min(col0, col1)), width);
+        rect.y0 = clampTo(std::floor(std::min(row0, row1)), height);
+        rect.x1 = clampTo(std::ceil(std::max(col0, col1)), width);
+        rect.y1 = clampTo(std::ceil(std::max(row0, row1)), height);
+        if (rect.width() < 2 || rect.height() < 2) return;
+        setRoi(rect);
+    }
+
+    // Outline of the selection being dragged, or of the ROI on the mid-height plane
+    void drawRoiOverlay() {
+        ImDrawList* draw = ImGui::GetForegroundDrawList();
+        ImU32 color = IM_COL32(255, 255, 255, 220);
+        if (selectingRoi) {
+            draw->AddRect(ImVec2(static_cast<float>(roiStartX), static_cast<float>(roiStartY)),
+                          ImVec2(static_cast<float>(lastX), static_cast<float>(lastY)), color);
+            return;
+        }
+        if (roi.empty()) return;
+        const ImVec2 size = ImGui::GetIO().DisplaySize;
+        if (size.x <= 0.0f || size.y <= 0.0f) return;
+        glm::mat4 mvp = camera.projection(size.x / size.y) * camera.view();
+        float planeZ = 0.5f * (rawZMin + rawZMax) * zScale;
+        const float cols[4] = {static_cast<float>(roi.x0), static_cast<float>(roi.x1), static_cast<float>(roi.x1), static_cast<float>(roi.x0)};
+        const float rows[4] = {static_cast<float>(roi.y0), static_cast<float>(roi.y0), static_cast<float>(roi.y1), static_cast<float>(roi.y1)};
+        ImVec2 corners[4];
+        for (int i = 0; i < 4; i++) {
+            glm::vec3 world = HeightPicker::toWorld(cols[i], rows[i], 0.0f, width, height, zScale);
+            world.z = planeZ;
+            if (!worldToScreen(mvp, world, size, corners[i])) return;
+        }
+        for (int i = 0; i < 4; i++) draw->AddLine(corners[i], corners[(i + 1) % 4], color, 2.0f);
+    }
+
+    // Picks the sample under the cursor for the readout, unless ImGui has the mouse
+    void updateHover() {
+        hoverValid = false;
+        if (!heightReadout || ImGui::GetIO().WantCaptureMouse || mouseDragging || panning || selectingRoi) return;
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        lastX = x;
+        lastY = y;
+        hoverValid = pickSurface(x, y, hoverHit);
+    }
+
+    // Height under the cursor next to it, and the measured points and line
+    void drawMeasureOverlay() {
+        ImDrawList* draw = ImGui::GetForegroundDrawList();
+        if (heightReadout && hoverValid) {
+            char text[96];
+            std::snprintf(text, sizeof(text), "(%u, %u)  z %.4g", hoverHit.col, hoverHit.row, hoverHit.z);
+            draw->AddText(ImVec2(static_cast<float>(lastX) + 14.0f, static_cast<float>(lastY) + 10.0f),
+                          IM_COL32(255, 255, 255, 255), text);
+        }
+        if (measurePoints == 0) return;
+        const ImVec2 size = ImGui::GetIO().DisplaySize;
+        if (size.x <= 0.0f || size.y <= 0.0f) return;
+        glm::mat4 mvp = camera.projection(size.x / size.y) * camera.view();
+        ImU32 color = IM_COL32(255, 64, 255, 255);
+        ImVec2 a, b;
+        bool aVisible = worldToScreen(mvp, HeightPicker::toWorld(static_cast<float>(measureA.col), static_cast<float>(measureA.row),
+                                                                 measureA.z, width, height, zScale), size, a);
+        if (aVisible) draw->AddCircleFilled(a, 4.0f, color);
+        if (measurePoints < 2) return;
+        bool bVisible = worldToScreen(mvp, HeightPicker::toWorld(static_cast<float>(measureB.col), static_cast<float>(measureB.row),
+                                                                 measureB.z, width, height, zScale), size, b);
+        if (bVisible) draw->AddCircleFilled(b, 4.0f, color);
+        if (aVisible && bVisible) draw->AddLine(a, b, color, 2.0f);
+    }
+
+    void showMeasureControls() {
+        ImGui::Checkbox("Height Under Cursor", &heightReadout);
+        if (measurePoints == 0) {
+            ImGui::Text("Alt + click two points on the surface to measure");
+            return;
+        }
+        ImGui::Text("A: (%u, %u) z %.4g", measureA.col, measureA.row, measureA.z);
+        if (measurePoints < 2) {
+            ImGui::Text("Alt + click the second point");
+            return;
+        }
+        ImGui::Text("B: (%u, %u) z %.4g", measureB.col, measureB.row, measureB.z);
+        float dx = static_cast<float>(measureB.col) - measureA.col;
+        float dy = static_cast<float>(measureB.row) - measureA.row;
+        float distance = std::sqrt(dx * dx + dy * dy);
+        ImGui::Text("Height difference: %.4g", measureB.z - measureA.z);
+        ImGui::Text("Distance: %.1f samples (%.0f x %.0f)", distance, dx, dy);
+        if (!measureProfile.empty()) {
+            auto range = std::minmax_element(measureProfile.begin(), measureProfile.end());
+            ImGui::PlotLines("Profile", measureProfile.data(), static_cast<int>(measureProfile.size()), 0, nullptr,
+                             *range.first, *range.second, ImVec2(0, 100));
+            ImGui::Text("Profile: %zu points, %.4g to %.4g (peak to valley %.4g)", measureProfile.size(),
+                        *range.first, *range.second, *range.second - *range.first);
+        }
+        if (ImGui::Button("Clear Measurement")) {
+            measurePoints = 0;
+            measureProfile.clear();
+        }
+    }
+
+    void showRoiControls() {
+        if (roi.empty()) {
+            ImGui::Text("Whole scan (ctrl + drag on the surface to select a region)");
+            return;
+        }
+        ImGui::Text("%ux%u samples at (%u, %u)", roi.width(), roi.height(), roi.x0, roi.y0);
+        ImGui::SameLine();
+        if (ImGui::Button("Clear ROI")) {
+            setRoi(GridRect());
+            return;
+        }
+        updateInputStats();
+        ImGui::Text("Raw: mean %.4g, std dev %.4g, %.4g to %.4g", inputStats.mean, inputStats.stdDev, inputStats.min,
+                    inputStats.max);
+        if (inputStats.invalid > 0) ImGui::Text("  %llu invalid samples", (unsigned long long)inputStats.invalid);
+        if (filterApplied && roiZ.size() == roi.size()) {
+            ImGui::Text("Filtered: mean %.4g, std dev %.4g, %.4g to %.4g", filteredStats.mean, filteredStats.stdDev,
+                        filteredStats.min, filteredStats.max);
+        }
+    }
+
+    void updateInputStats() {
+        if (inputStatsValid || raw.empty()) return;
+        ScopedTimer timer("Surface stats");
+        inputStats = SurfaceStats::compute(roi.empty() ? raw : roiRaw);
+        inputStatsValid = true;
+    }
+
+    // Asks the workers for the PSD of their results while the Roughness section
+    // is open; opening it filters again if the shown result has none
+    void setSpectrumWanted(bool wanted) {
+        size_t bins = wanted ? SpectrumBins : 0;
+        if (bins == spectrumBins) return;
+        spectrumBins = bins;
+        filterWorker.setSpectrumBins(bins);
+        liveFolder.setSpectrumBins(bins);
+        if (bins > 0 && filterApplied && filteredSpectrum.empty()) requestFilter();
+    }
+
+    // Areal roughness parameters of the filter input and result side by side,
+    // and the result's PSD on a log scale
+    void showRoughnessControls() {
+        updateInputStats();
+        bool filtered = filterApplied && (roi.empty() || roiZ.size() == roi.size());
+        ImGui::Text("%s, about the mean height", roi.empty() ? "Whole scan" : "Region of interest");
+        if (ImGui::BeginTable("roughness", 3)) {
+            ImGui::TableSetupColumn("Parameter");
+            ImGui::TableSetupColumn("Raw");
+            ImGui::TableSetupColumn("Filtered");
+            ImGui::TableHeadersRow();
+            auto row = [&](const char* name, double SurfaceStats::*value) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", name);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.4g", inputStats.*value);
+                ImGui::TableNextColumn();
+                if (filtered) ImGui::Text("%.4g", filteredStats.*value);
+                else ImGui::TextDisabled("-");
+            };
+            row("Sa", &SurfaceStats::sa);
+            row("Sq", &SurfaceStats::sq);
+            row("Sp", &SurfaceStats::sp);
+            row("Sv", &SurfaceStats::sv);
+            row("Sz", &SurfaceStats::sz);
+            row("Ssk", &SurfaceStats::ssk);
+            row("Sku", &SurfaceStats::sku);
+            ImGui::EndTable();
+        }
+
+        if (!filtered || filteredSpectrum.empty()) {
+            ImGui::TextDisabled("Apply the filter to see the power spectral density");
+            return;
+        }
+        std::vector<float> logPower(filteredSpectrum.power.size());
+        float lo = std::numeric_limits<float>::max(), hi = std::numeric_limits<float>::lowest();
+        size_t peak = 0;
+        for (size_t i = 0; i < logPower.size(); i++) {
+            float p = filteredSpectrum.power[i];
+            logPower[i] = p > 0.0f ? std::log10(p) : std::numeric_limits<float>::quiet_NaN();
+            if (p <= 0.0f) continue;
+            lo = std::min(lo, logPower[i]);
+            hi = std::max(hi, logPower[i]);
+            if (p > filteredSpectrum.power[peak]) peak = i;
+        }
+        for (float& v : logPower) {
+            if (!std::isfinite(v)) v = lo;
+        }
+        ImGui::PlotLines("PSD", logPower.data(), static_cast<int>(logPower.size()), 0, "log10 power", lo, hi,
+                         ImVec2(0, 100));
+        ImGui::Text("0 to 0.5 cycles/sample; peak at %.4g cycles/sample (%.1f samples)",
+                    filteredSpectrum.frequency[peak], 1.0f / filteredSpectrum.frequency[peak]);
+    }
+
+    // Picks the coarsest level that still has about lodDetail samples per screen
+    // pixel across the surface at the current zoom. Level 0 while nothing is uploaded.
+    size_t selectLodLevel(int viewportHeight) const {
+        if (renderer.levelCount() == 0) return 0;
+        if (!autoLod) return std::min<size_t>(std::max(manualLodLevel, 0), renderer.levelCount() - 1);
+        return renderer.levelFor(camera.surfacePixels(viewportHeight) * lodDetail);
+    }
+
+    // Picks up a finished result from the filter worker and uploads it
+    void applyFilterResult() {
+        float zMinVal, zMaxVal;
+        if (roi.empty()) {
+            if (!filterWorker.takeResult(zMap, zMinVal, zMaxVal, &filteredStats, &filteredSpectrum)) return;
+            filterApplied = true;
+            patchedRect = GridRect{0, 0, width, height};
+            uploadSurface();
+        } else {
+            if (!filterWorker.takeResult(roiZ, zMinVal, zMaxVal, &filteredStats, &filteredSpectrum)) return;
+            patchRoi();
+        }
+        updateMeasurement();
 
         zMin = zMinVal;
         zMax = zMaxVal;
+        filteredZMin = zMinVal;
+        filteredZMax = zMaxVal;
         histogramNeedsUpdate = true;
     }
 
+    // Writes the filtered ROI into zMap, which shows raw samples everywhere else,
+    // and updates only the ROI (and a previously patched region) on the GPU. Only
+    // the first ROI result after raw or a full-scan filter was shown has to fill
+    // zMap from raw and upload it whole.
+    void patchRoi() {
+        size_t count = static_cast<size_t>(width) * height;
+        GridRect all{0, 0, width, height};
+        bool full = !filterApplied || zMap.size() != count || patchedRect == all;
+        if (full) {
+            zMap.resize(count);
+            parallelFor(count, chunkCount(count), [&](size_t, size_t begin, size_t end) {
+                raw.copyTo(begin, end - begin, zMap.data() + begin);
+            });
+        } else if (patchedRect != roi) {
+            for (uint32_t y = patchedRect.y0; y < patchedRect.y1; y++) {
+                size_t index = static_cast<size_t>(y) * width + patchedRect.x0;
+                raw.copyTo(index, patchedRect.width(), zMap.data() + index);
+            }
+        }
+        for (uint32_t y = 0; y < roi.height(); y++) {
+            std::memcpy(zMap.data() + static_cast<size_t>(roi.y0 + y) * width + roi.x0,
+                        roiZ.data() + static_cast<size_t>(y) * roi.width(), roi.width() * sizeof(float));
+        }
+        GridRect previous = patchedRect;
+        patchedRect = roi;
+        filterApplied = true;
+        if (full) {
+            uploadSurface();
+            return;
+        }
+        if (previous != roi) uploadRegion(previous);
+        uploadRegion(roi);
+    }
+
+    // Advances stack playback, or shows a scrubbed-to frame once it is decoded
+    void updateStack() {
+        int frames = static_cast<int>(stackPlayer.frameCount());
+        if (frames < 2) return;
+        if (requestedStackFrame >= 0) {
+            if (showStackFrame(requestedStackFrame)) requestedStackFrame = -1;
+            return;
+        }
+        if (!stackPlaying) {
+            bindStackFrame();
+            return;
+        }
+
+        double now = glfwGetTime();
+        if (now < nextStackFrameTime) return;
+        int next = stackFrame + 1;
+        if (next >= frames) {
+            if (!stackLoop) {
+                stackPlaying = false;
+                return;
+            }
+            next = 0;
+        }
+        if (showStackFrame(next)) {
+            // Keep the schedule unless we fell more than a frame behind it
+            double interval = 1.0 / stackFps;
+            nextStackFrameTime = std::max(nextStackFrameTime + interval, now);
+            stackWaiting = false;
+        } else if (!stackWaiting) {
+            stackWaiting = true;
+            stackLateFrames++;
+        }
+    }
+
+    // Streams a decoded stack frame to the GPU; false if it is not decoded yet.
+    // Frames come filtered by the stack player once a filter was requested.
+    bool showStackFrame(int index) {
+        std::shared_ptr<StackFrame> frame = stackPlayer.take(static_cast<size_t>(index));
+        if (!frame) return false;
+        ScopedTimer timer("Stack frame");
+        if (frame->map.width != width || frame->map.height != height) {
+            errorMessage = "Stack frame " + std::to_string(index) + " has a different size";
+            stackPlaying = false;
+            return true;
+        }
+        currentScan.reset();
+        surfaceVersion++;
+        raw = frame->map;
+        // The filter worker keeps the previous frame until playback stops
+        updateFilterInput();
+        filterApplied = frame->filtered.size() == raw.size();
+        if (filterApplied) {
+            zMap.swap(frame->filtered);
+            patchedRect = GridRect{0, 0, width, height};
+            filteredZMin = frame->filteredStats.min;
+            filteredZMax = frame->filteredStats.max;
+            filteredStats = frame->filteredStats;
+        }
+        filteredSpectrum = PowerSpectrum();  // Computed again once playback stops
+        renderer.stream(0, displayMap());
+        pyramid = std::move(frame->pyramid);
+        tileGrids = std::move(frame->tileGrids);
+        for (size_t i = 0; i < pyramid.levelCount(); i++) {
+            const HeightPyramid::Level& level = pyramid.level(i);
+            renderer.stream(i + 1, level.mean, level.width, level.height);
+        }
+        renderer.trimLevels(pyramid.levelCount() + 1);
+
+        // The slider range follows the frame on screen; the color range stays put
+        invalidSamples = frame->stats.invalid;
+        rawZMin = frame->stats.min;
+        rawZMax = frame->stats.max;
+        updateMeasurement();
+        stackFrame = index;
+        return true;
+    }
+
+    // Points the filter worker at the frame on screen once playback stops, and
+    // filters it there again so later edits start from its cached stages
+    void bindStackFrame() {
+        if (!filterInputStale) return;
+        bool filtered = filterApplied;
+        setFilterInput();
+        if (filtered) requestFilter();
+    }
+
+    void showStackControls() {
+        int frames = static_cast<int>(stackPlayer.frameCount());
+        if (stackPlayer.isIndexing()) {
+            ImGui::Text("Indexing stack pages...");
+            return;
+        }
+        if (frames < 2) return;
+        int frame = requestedStackFrame >= 0 ? requestedStackFrame : stackFrame;
+        if (ImGui::SliderInt("Frame", &frame, 0, frames - 1)) {
+            stackPlaying = false;
+            requestedStackFrame = frame;
+            stackPlayer.seek(frame, stackLoop);
+        }
+        if (ImGui::Button(stackPlaying ? "Pause" : "Play")) {
+            stackPlaying = !stackPlaying;
+            if (stackPlaying) {
+                requestedStackFrame = -1;
+                stackWaiting = false;
+                nextStackFrameTime = glfwGetTime();
+                stackPlayer.seek(stackFrame + 1 < frames ? stackFrame + 1 : 0, stackLoop);
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Loop", &stackLoop)) {
+            stackPlayer.seek(stackFrame + 1 < frames ? stackFrame + 1 : 0, stackLoop);
+        }
+        ImGui::SliderFloat("Playback FPS", &stackFps, 1.0f, 120.0f, "%.0f");
+        if (ImGui::SliderInt("Decode Ahead", &stackLookahead, 2, 32)) {
+            stackPlayer.setLookahead(stackLookahead);
+        }
+        ImGui::Text("Frame %d / %d, %zu decoded ahead, %zu late", stackFrame + 1, frames,
+                    stackPlayer.buffered(), stackLateFrames);
+        std::string error = stackPlayer.error();
+        if (!error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Error: %s", error.c_str());
+        }
+    }
+
+    // Rebuilds only the histograms whose data or bin count changed
+    void updateHistograms() {
+        if (rawHistogramNeedsUpdate) {
+            const ScanFile* file = currentScan ? currentScan->file.get() : nullptr;
+            if (!roi.empty()) {
+                rawHistogram.compute(roiRaw, rawZMin, rawZMax, histogramBins);
+            } else if (file && file->histogramBins == static_cast<uint32_t>(histogramBins) &&
+                file->histogramMin == rawZMin && file->histogramMax == rawZMax) {
+                rawHistogram.assign(file->histogramCounts, histogramBins, file->histogramOutside, rawZMin, rawZMax);
+            } else {
+                rawHistogram.compute(raw, rawZMin, rawZMax, histogramBins);
+                if (currentScan) scanCache.provideHistogram(*currentScan, rawHistogram);
+            }
+            rawHistogramNeedsUpdate = false;
+        }
+        if (histogramNeedsUpdate && filterApplied) {
+            if (roi.empty()) {
+                filteredHistogram.compute(displayMap(), filteredZMin, filteredZMax, histogramBins);
+            } else if (roiZ.size() == roi.size()) {
+                filteredHistogram.compute(HeightMap::view(roiZ.data(), roi.width(), roi.height()), filteredZMin,
+                                          filteredZMax, histogramBins);
+            }
+            histogramNeedsUpdate = false;
+        }
+    }
+
+    // Host memory held for the current scan and GPU memory of the uploaded levels,
+    // plus what the driver reports as free where it exposes that
+    void showMemoryFootprint() {
+        double mb = 1.0 / (1024.0 * 1024.0);
+        size_t filtered = (zMap.capacity() + roiZ.capacity()) * sizeof(float) + roiRaw.bytes();
+        size_t worker = filterWorker.bytes();
+        size_t host = raw.bytes() + filtered + worker + pyramid.bytes() + FftBufferPool::cachedBytes();
+        size_t cachedOther = scanCache.bytes() - (currentScan ? std::min(scanCache.bytes(), raw.bytes()) : 0);
+        size_t keptGpu = 0, keptHost = 0;
+        for (const auto& surface : surfaceCache) {
+            keptGpu += SurfaceRenderer::levelBytes(surface.levels);
+            keptHost += cachedSurfaceBytes(surface) - SurfaceRenderer::levelBytes(surface.levels);
+        }
+        host += cachedOther + keptHost;
+        ImGui::Text("Host memory: %.1f MB", host * mb);
+        ImGui::BulletText("Scan: %.1f MB (%s%s)", raw.bytes() * mb,
+                          raw.format == HeightMap::UInt16 ? "16-bit" : raw.format == HeightMap::UInt8 ? "8-bit" : "float",
+                          currentScan && currentScan->file ? ", mapped" : "");
+        ImGui::BulletText("Filtered: %.1f MB, filter buffers: %.1f MB", filtered * mb, worker * mb);
+        ImGui::BulletText("LOD pyramid: %.1f MB%s, FFT pool: %.1f MB", pyramid.bytes() * mb, pyramid.mapped() ? " (mapped)" : "",
+                          FftBufferPool::cachedBytes() * mb);
+        ImGui::BulletText("Other cached scans: %.1f MB (%zu scans cached)", cachedOther * mb, scanCache.size());
+        ImGui::BulletText("Pyramids kept for cached scans: %.1f MB", keptHost * mb);
+        ImGui::Text("GPU buffers: %.1f MB, kept for cached scans: %.1f MB", renderer.gpuBytes() * mb, keptGpu * mb);
+        if (GLEW_NVX_gpu_memory_info) {
+            GLint totalKb = 0, freeKb = 0;
+            glGetIntegerv(GL_GPU_MEMORY_TOTAL_AVAILABLE_MEMORY_NVX, &totalKb);
+            glGetIntegerv(GL_GPU_MEMORY_CURRENT_AVAILABLE_MEMORY_NVX, &freeKb);
+            ImGui::Text("GPU free: %.0f / %.0f MB", freeKb / 1024.0, totalKb / 1024.0);
+        } else if (GLEW_ATI_meminfo) {
+            GLint info[4] = {0, 0, 0, 0};
+            glGetIntegerv(GL_VBO_FREE_MEMORY_ATI, info);
+            ImGui::Text("GPU free (VBO pool): %.0f MB", info[0] / 1024.0);
+        }
+    }
+
+    void showProfilingControls() {
+        ImGui::Checkbox("Performance Overlay", &showPerformance);
+        showFrameRateControls();
+        if (ImGui::Checkbox("Record Trace", &recordTrace)) {
+            Profiler::instance().setRecording(recordTrace);
+        }
+        ImGui::SameLine();
+        ImGui::Text("%zu events", Profiler::instance().eventCount());
+        std::string error;
+        if (ImGui::Button("Export Chrome Trace")) {
+            const char* path = "scan_viewer_trace.json";
+            traceMessage = Profiler::instance().writeChromeTrace(path, error) ? std::string("Wrote ") + path : error;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Export CSV")) {
+            const char* path = "scan_viewer_trace.csv";
+            traceMessage = Profiler::instance().writeCsv(path, error) ? std::string("Wrote ") + path : error;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            Profiler::instance().clearEvents();
+            traceMessage.clear();
+        }
+        if (!traceMessage.empty()) ImGui::Text("%s", traceMessage.c_str());
+    }
+
+    void showFrameRateControls() {
+        ImGui::Checkbox("Idle Throttling", &idleThrottling);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Only redraw after input, scene changes or while work is in progress");
+        }
+        ImGui::SliderInt("Frame Rate Cap", &frameRateCap, 0, 240, frameRateCap > 0 ? "%d fps" : "Uncapped");
+    }
+
+    void requestRedraw() { redrawFrames = RedrawFrames; }
+
+    // Filtering, live loading, playback, stack decoding, prefetching or indexing in progress;
+    // frames keep coming while any of it runs so progress stays visible
+    bool backgroundWork() const {
+        size_t indexed, toIndex;
+        folderIndex.progress(indexed, toIndex);
+        return filterWorker.busy() || liveFolder.busy() || stackPlaying || requestedStackFrame >= 0 ||
+               scanCache.prefetching() || scanCache.writingFiles() || indexed < toIndex;
+    }
+
+    // Processes events and returns when the next frame should be drawn
+    void waitForFrame() {
+        bool working = backgroundWork();
+        // One more round of frames picks up whatever the finished work produced
+        if (wasWorking && !working) requestRedraw();
+        wasWorking = working;
+        if (idleThrottling && !working && redrawFrames == 0) {
+            glfwWaitEvents();
+            Profiler::instance().restartFrame();
+            requestRedraw();
+        }
+        if (frameRateCap > 0) {
+            std::this_thread::sleep_until(lastFrameStart + std::chrono::microseconds(1000000 / frameRateCap));
+        }
+        glfwPollEvents();
+        lastFrameStart = std::chrono::steady_clock::now();
+        if (redrawFrames > 0) redrawFrames--;
+    }
+
+    // Frame time percentiles over the rolling window and the latest time of each stage
+    void showPerformanceOverlay() {
+        const ImGuiIO& io = ImGui::GetIO();
+        ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x - 10.0f, 10.0f), ImGuiCond_Always, ImVec2(1.0f, 0.0f));
+        ImGui::SetNextWindowBgAlpha(0.6f);
+        ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+                                 ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing |
+                                 ImGuiWindowFlags_NoNav;
+        if (ImGui::Begin("Performance", &showPerformance, flags)) {
+            std::vector<float> frames = Profiler::instance().recentFrames();
+            if (!frames.empty()) {
+                float p50 = Profiler::percentile(frames, 0.5f);
+                ImGui::Text("Frame %.2f ms (%.0f FPS)", frames.back(), p50 > 0.0f ? 1000.0f / p50 : 0.0f);
+                ImGui::Text("p50 %.2f  p95 %.2f  p99 %.2f ms", p50, Profiler::percentile(frames, 0.95f),
+                            Profiler::percentile(frames, 0.99f));
+                ImGui::PlotLines("##frames", frames.data(), static_cast<int>(frames.size()), 0, nullptr, 0.0f,
+                                 Profiler::percentile(frames, 0.99f) * 1.5f, ImVec2(240, 50));
+            }
+            if (ImGui::BeginTable("stages", 4)) {
+                ImGui::TableSetupColumn("Stage");
+                ImGui::TableSetupColumn("Last ms");
+                ImGui::TableSetupColumn("Mean ms");
+                ImGui::TableSetupColumn("Max ms");
+                ImGui::TableHeadersRow();
+                for (const auto& entry : Profiler::instance().stageStats()) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", entry.first.c_str());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", entry.second.lastMs);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", entry.second.meanMs);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", entry.second.maxMs);
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // Picks up new folder index results and uploads their thumbnails
+    void pollFolderIndex() {
+        if (!folderIndex.snapshot(indexEntries, indexVersion)) return;
+        std::vector<uint8_t> rgba;
+        for (const auto& kv : indexEntries) {
+            const IndexEntry& entry = kv.second;
+            if (entry.state != IndexEntry::Ready || entry.thumbnail.empty() || thumbnailTextures.count(kv.first)) continue;
+            rgba.resize(entry.thumbnail.size() * 4);
+            for (size_t i = 0; i < entry.thumbnail.size(); i++) {
+                rgba[4 * i] = rgba[4 * i + 1] = rgba[4 * i + 2] = entry.thumbnail[i];
+                rgba[4 * i + 3] = 255;
+            }
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, entry.thumbWidth, entry.thumbHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+            thumbnailTextures[kv.first] = texture;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void clearThumbnails() {
+        for (auto& kv : thumbnailTextures) glDeleteTextures(1, &kv.second);
+        thumbnailTextures.clear();
+    }
+
+    // Thumbnail and one-line summary of a file from the folder index
+    void showIndexEntry(const std::string& name) {
+        auto it = indexEntries.find(name);
+        if (it == indexEntries.end() || it->second.state == IndexEntry::Pending) {
+            ImGui::TextDisabled("indexing...");
+            return;
+        }
+        const IndexEntry& entry = it->second;
+        if (entry.state == IndexEntry::Failed) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%s", entry.error.c_str());
+            return;
+        }
+        auto texture = thumbnailTextures.find(name);
+        if (texture != thumbnailTextures.end()) {
+            float scale = 32.0f / FolderIndex::ThumbnailSize;
+            ImVec2 size(entry.thumbWidth * scale, entry.thumbHeight * scale);
+            ImGui::Image((ImTextureID)(intptr_t)texture->second, size);
+            if (ImGui::IsItemHovered()) {
+                ImGui::BeginTooltip();
+                ImGui::Image((ImTextureID)(intptr_t)texture->second, ImVec2(entry.thumbWidth * 3.0f, entry.thumbHeight * 3.0f));
+                ImGui::Text("%s, compression %u%s", entry.info.tiled ? "tiled" : "stripped",
+                            entry.info.compression, entry.info.bigTiff ? ", BigTIFF" : "");
+                if (entry.invalid > 0) ImGui::Text("%llu invalid samples", (unsigned long long)entry.invalid);
+                ImGui::EndTooltip();
+            }
+            ImGui::SameLine();
+        }
+        ImGui::TextDisabled("%ux%u %u-bit%s, Z %.4g to %.4g", entry.info.width, entry.info.height, entry.info.bitsPerSample,
+                            entry.info.sampleFormat == SAMPLEFORMAT_IEEEFP ? " float" : "", entry.zMin, entry.zMax);
+    }
+
     void updateTiffFiles(const std::string& folderPath) {
         tiffFiles.clear();
         DIR* dir = opendir(folderPath.c_str());
@@ -378,6 +1384,12 @@ private:
             }
         }
         closedir(dir);
+        std::sort(tiffFiles.begin(), tiffFiles.end());
+        currentFileIndex = -1;
+        clearThumbnails();
+        indexEntries.clear();
+        folderIndex.open(folderPath, tiffFiles);
+        scanCache.prefetch({}, keepNativePrecision);
         errorMessage.clear();
     }
 
@@ -424,8 +1436,7 @@ public:
             exit(EXIT_FAILURE);
         }
 
-        shaderProgram = createShaderProgram();
-        if (shaderProgram == 0) {
+        if (!renderer.init()) {
             std::cerr << "Failed to create shader program" << std::endl;
             glfwDestroyWindow(window);
             glfwTerminate();
@@ -433,27 +1444,20 @@ public:
         }
 
         loadDefaultData();
-
-        glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &vbo);
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(Point3D), points.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Point3D), (void*)0);
-        glEnableVertexAttribArray(0);
-        GLenum err = glGetError();
-        if (err != GL_NO_ERROR) {
-            std::cerr << "OpenGL error during initialization: " << err << std::endl;
-        }
+        // Wakes the event wait in waitForFrame() when a live scan arrives
+        liveFolder.setNotify([] { glfwPostEmptyEvent(); });
 
         filterParams.push_back(0.5f);
         glPointSize(2.0f);
     }
 
     ~ScanViewer() {
-        glDeleteBuffers(1, &vbo);
-        glDeleteVertexArrays(1, &vao);
-        glDeleteProgram(shaderProgram);
+        folderIndex.stop();
+        liveFolder.stop();
+        clearThumbnails();
+        clearSurfaceCache();
+        drawTimer.destroy();
+        renderer.destroy();
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
@@ -461,58 +1465,20 @@ public:
         glfwTerminate();
     }
 
-    GLuint createShaderProgram() {
-        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-        glCompileShader(vertexShader);
-        GLint success;
-        glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-            std::cerr << "Vertex shader compilation failed: " << infoLog << std::endl;
-            return 0;
-        }
-
-        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-        glCompileShader(fragmentShader);
-        glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-            std::cerr << "Fragment shader compilation failed: " << infoLog << std::endl;
-            glDeleteShader(vertexShader);
-            return 0;
-        }
-
-        GLuint program = glCreateProgram();
-        glAttachShader(program, vertexShader);
-        glAttachShader(program, fragmentShader);
-        glLinkProgram(program);
-        glGetProgramiv(program, GL_LINK_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetProgramInfoLog(program, 512, NULL, infoLog);
-            std::cerr << "Shader program linking failed: " << infoLog << std::endl;
-            glDeleteShader(vertexShader);
-            glDeleteShader(fragmentShader);
-            return 0;
-        }
-
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        return program;
-    }
-
     void run() {
         const char* controlItems[] = {"Controls", "Data", "About"};
         const char* lutItems[] = {"Jet", "Viridis", "Plasma", "Hot", "Cool", "Turbo"};
+        const char* plannerItems[] = {"Estimate", "Measure", "Patient"};
+        const char* paddingItems[] = {"None", "Mirror", "Mean"};
+        const char* windowItems[] = {"None", "Tukey", "Hann"};
+        const char* stageItems[] = {"Level", "Gaussian", "Median", "Clip Outliers", "Bandpass"};
         int currentItem = 0;
-        std::string selectedFolder;
 
         while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+            waitForFrame();
+            applyFilterResult();
+            applyLiveScan();
+            updateStack();
 
             ImGui_ImplOpenGL3_NewFrame();
             ImGui_ImplGlfw_NewFrame();
@@ -526,23 +1492,74 @@ public:
                 ImGui::SliderFloat("Z Min", &zMin, rawZMin, zMax);
                 ImGui::SliderFloat("Z Max", &zMax, zMin, rawZMax);
                 ImGui::Combo("Color LUT", &colorLUT, lutItems, IM_ARRAYSIZE(lutItems));
+                ImGui::Checkbox("Auto LOD", &autoLod);
+                if (autoLod) {
+                    ImGui::SliderFloat("LOD Detail", &lodDetail, 0.25f, 4.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+                } else if (renderer.levelCount() > 0) {
+                    ImGui::SliderInt("LOD Level", &manualLodLevel, 0, (int)renderer.levelCount() - 1);
+                }
+                ImGui::Text("Drawing level %zu: %ux%u", drawnLodLevel,
+                            renderer.gridWidth(drawnLodLevel), renderer.gridHeight(drawnLodLevel));
+                if (stackPlayer.isIndexing() || stackPlayer.frameCount() > 1) {
+                    if (ImGui::CollapsingHeader("Stack")) {
+                        showStackControls();
+                    }
+                }
+                ImGui::Checkbox("Tile Culling", &tileCulling);
+                if (tileCulling && drawnLodLevel < tileGrids.size()) {
+                    ImGui::Text("Visible tiles: %zu / %zu (%zu points)", drawRanges.visibleTiles,
+                                tileGrids[drawnLodLevel].tileCount(), drawRanges.points);
+                }
+                if (ImGui::CollapsingHeader("Measure")) {
+                    showMeasureControls();
+                }
+                if (ImGui::CollapsingHeader("Region of Interest")) {
+                    showRoiControls();
+                }
+                bool roughnessOpen = ImGui::CollapsingHeader("Roughness");
+                setSpectrumWanted(roughnessOpen);
+                if (roughnessOpen) {
+                    showRoughnessControls();
+                }
+                if (ImGui::CollapsingHeader("Profiling")) {
+                    showProfilingControls();
+                }
+                if (ImGui::CollapsingHeader("Filter Pipeline")) {
+                    showPipelineControls(stageItems, IM_ARRAYSIZE(stageItems));
+                }
                 if (ImGui::CollapsingHeader("Histogram")) {
-                    if (!rawZMap.empty()) {
-                        const int bins = 100;
-                        std::vector<float> hist(bins, 0.0f);
-                        float binWidth = (rawZMax - rawZMin) / bins;
-                        for (float z : rawZMap) {
-                            int bin = std::min(static_cast<int>((z - rawZMin) / binWidth), bins - 1);
-                            if (bin >= 0 && bin < bins) hist[bin]++;
+                    if (!raw.empty()) {
+                        if (ImGui::SliderInt("Bins", &histogramBins, 10, 1000)) {
+                            rawHistogramNeedsUpdate = true;
+                            histogramNeedsUpdate = true;
+                            scanCache.setCacheFiles(useScanFiles, histogramBins);
                         }
-                        float maxCount = *std::max_element(hist.begin(), hist.end());
-                        if (maxCount > 0) {
-                            for (float& count : hist) count /= maxCount;  // Normalize to 0-1
+                        updateHistograms();
+                        const std::vector<float>& hist = rawHistogram.normalized();
+                        ImGui::PlotHistogram("Z Histogram", hist.data(), (int)hist.size(), 0, nullptr, 0.0f, 1.0f, ImVec2(0, 100));
+                        if (filterApplied) {
+                            const std::vector<float>& filtered = filteredHistogram.normalized();
+                            ImGui::PlotHistogram("Filtered Histogram", filtered.data(), (int)filtered.size(), 0, nullptr, 0.0f, 1.0f, ImVec2(0, 100));
+                            ImGui::Text("Filtered Z range: %.3f to %.3f", filteredZMin, filteredZMax);
                         }
-                        ImGui::PlotHistogram("Z Histogram", hist.data(), bins, 0, nullptr, 0.0f, 1.0f, ImVec2(0, 100));
                         ImGui::SliderFloat2("Filter Range (μm)", &filterLowCutoff, rawZMin, rawZMax, "%.3f");
                         if (ImGui::IsItemEdited()) {
-                            applyFourierFilter();
+                            requestFilter();
+                        }
+                        if (filterWorker.busy()) {
+                            ImGui::ProgressBar(filterWorker.progress(), ImVec2(-1, 0), "Filtering...");
+                        }
+                        if (ImGui::Combo("FFT Planner", &fftPlannerEffort, plannerItems, IM_ARRAYSIZE(plannerItems))) {
+                            filterWorker.setPlannerEffort(static_cast<FftEngine::PlannerEffort>(fftPlannerEffort));
+                            configureLive();
+                        }
+                        bool edgeChanged = ImGui::Combo("FFT Padding", &fftPadding, paddingItems, IM_ARRAYSIZE(paddingItems));
+                        edgeChanged |= ImGui::Combo("Apodization", &fftWindow, windowItems, IM_ARRAYSIZE(windowItems));
+                        if (edgeChanged) {
+                            filterWorker.setEdgeHandling(static_cast<BandpassFilter::Padding>(fftPadding),
+                                                         static_cast<BandpassFilter::Window>(fftWindow));
+                            configureLive();
+                            if (filterApplied) requestFilter();
                         }
                     }
                 }
@@ -554,28 +1571,76 @@ public:
                     if (!path.empty()) {
                         selectedFolder = path;
                         updateTiffFiles(path);
+                        if (liveFolder.active()) setLiveMode(true);
                     }
                 }
                 ImGui::SameLine();
                 if (ImGui::Button("Load Default Data")) {
                     loadDefaultData();
                 }
+                showLiveControls();
 
                 if (!tiffFiles.empty()) {
                     ImGui::Text("TIFF Files in %s:", selectedFolder.c_str());
-                    for (const auto& file : tiffFiles) {
-                        if (ImGui::Button(file.c_str())) {
-                            std::string fullPath = selectedFolder + "/" + file;
-                            if (!loadTiffZMap(fullPath)) {
-                                loadDefaultData();
-                            }
+                    if (ImGui::Button("< Prev") && currentFileIndex > 0) {
+                        openFile(currentFileIndex - 1);
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Next >")) {
+                        openFile(currentFileIndex + 1);
+                    }
+                    if (scanCache.prefetching()) {
+                        ImGui::SameLine();
+                        ImGui::Text("Prefetching...");
+                    }
+                    pollFolderIndex();
+                    size_t indexed, toIndex;
+                    folderIndex.progress(indexed, toIndex);
+                    if (indexed < toIndex) {
+                        ImGui::Text("Indexing %zu / %zu files", indexed, toIndex);
+                    }
+                    for (size_t i = 0; i < tiffFiles.size(); i++) {
+                        bool current = static_cast<int>(i) == currentFileIndex;
+                        ImGui::PushID(static_cast<int>(i));
+                        if (current) ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(0.2f, 0.5f, 0.2f, 1.0f));
+                        bool clicked = ImGui::Button(tiffFiles[i].c_str());
+                        if (current) ImGui::PopStyleColor();
+                        ImGui::SameLine();
+                        showIndexEntry(tiffFiles[i]);
+                        ImGui::PopID();
+                        if (clicked) {
+                            openFile(static_cast<int>(i));
                         }
                     }
                 } else if (!selectedFolder.empty()) {
                     ImGui::Text("No TIFF files found in %s", selectedFolder.c_str());
                 }
 
+                if (ImGui::SliderInt("Scan Cache (MB)", &scanCacheMegabytes, 0, 16384)) {
+                    scanCache.setBudget(static_cast<size_t>(scanCacheMegabytes) << 20);
+                }
+                if (ImGui::Checkbox("Use cache files", &useScanFiles)) {
+                    scanCache.setCacheFiles(useScanFiles, histogramBins);
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Write a .svcache file beside each scan and map it on later visits");
+                }
+                if (scanCache.writingFiles()) {
+                    ImGui::SameLine();
+                    ImGui::Text("Writing cache file...");
+                }
+                if (ImGui::Checkbox("Keep native precision", &keepNativePrecision)) configureLive();
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Store 8/16-bit scans as integers instead of floats (next load)");
+                }
+
                 ImGui::Text("Current data source: %s", currentDataSource.c_str());
+                if (invalidSamples > 0) {
+                    ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), "%zu invalid (NaN/inf) samples", invalidSamples);
+                }
+                if (ImGui::CollapsingHeader("Memory")) {
+                    showMemoryFootprint();
+                }
                 if (!errorMessage.empty()) {
                     ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Error: %s", errorMessage.c_str());
                 }
@@ -586,8 +1651,11 @@ public:
                 ImGui::Text("Features:");
                 ImGui::BulletText("Browse and load TIFF files from a folder via GUI");
                 ImGui::BulletText("Interactive 3D view with mouse rotation (left-click), zoom (scroll), and pan (shift + left-click)");
+                ImGui::BulletText("Region of interest (ctrl + left-click drag) for filtering and statistics");
+                ImGui::BulletText("Height under the cursor, point-to-point measurement and line profile (alt + left-click)");
                 ImGui::BulletText("Adjustable Z scaling and multiple color LUTs");
                 ImGui::BulletText("Bandpass Fourier filter via histogram");
+                ImGui::BulletText("Filter pipeline: leveling, Gaussian, median, outlier clipping and bandpass");
                 ImGui::BulletText("Collapsible histogram of Z values");
                 ImGui::Text("Current data source: %s", currentDataSource.c_str());
                 if (!errorMessage.empty()) {
@@ -595,6 +1663,10 @@ public:
                 }
             }
             ImGui::End();
+            if (showPerformance) showPerformanceOverlay();
+            updateHover();
+            drawRoiOverlay();
+            drawMeasureOverlay();
 
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
             glEnable(GL_DEPTH_TEST);
@@ -602,31 +1674,39 @@ public:
             int width, height;
             glfwGetFramebufferSize(window, &width, &height);
             glViewport(0, 0, width, height);
-            projection = glm::perspective(glm::radians(45.0f), (float)width/height, 0.1f, 100.0f);
-            view = glm::translate(glm::mat4(1.0f), glm::vec3(panX, panY, -zoom));
-            view = glm::rotate(view, glm::radians(rotX), glm::vec3(1, 0, 0));
-            view = glm::rotate(view, glm::radians(rotY), glm::vec3(0, 1, 0));
+            projection = camera.projection((float)width/height);
+            view = camera.view();
             model = glm::mat4(1.0f);
             glm::mat4 mvp = projection * view * model;
 
-            glUseProgram(shaderProgram);
-            glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "mvp"), 1, GL_FALSE, glm::value_ptr(mvp));
-            glUniform1f(glGetUniformLocation(shaderProgram, "zMin"), zMin);
-            glUniform1f(glGetUniformLocation(shaderProgram, "zMax"), zMax);
-            glUniform1f(glGetUniformLocation(shaderProgram, "zScale"), zScale);
-            glUniform1i(glGetUniformLocation(shaderProgram, "colorLUT"), colorLUT);
-
-            glBindVertexArray(vao);
-            glDrawArrays(GL_POINTS, 0, points.size());
+            drawnLodLevel = selectLodLevel(height);
+            SceneState scene{mvp, zMin, zMax, zScale, colorLUT, drawnLodLevel, surfaceVersion};
+            if (scene != drawnScene || ImGui::IsAnyItemActive()) requestRedraw();
+            drawnScene = scene;
+            {
+                ScopedTimer timer("Draw (CPU)");
+                drawTimer.begin();
+                if (tileCulling && drawnLodLevel < tileGrids.size()) {
+                    tileGrids[drawnLodLevel].cull(mvp, zScale, drawRanges);
+                    renderer.draw(mvp, zMin, zMax, zScale, colorLUT, drawnLodLevel, &drawRanges);
+                } else {
+                    renderer.draw(mvp, zMin, zMax, zScale, colorLUT, drawnLodLevel);
+                }
+                drawTimer.end();
+            }
             GLenum err = glGetError();
             if (err != GL_NO_ERROR) {
                 std::cerr << "OpenGL error after rendering: " << err << std::endl;
             }
 
-            ImGui::Render();
-            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            {
+                ScopedTimer timer("UI render");
+                ImGui::Render();
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            }
 
             glfwSwapBuffers(window);
+            Profiler::instance().frame();
         }
     }
 };
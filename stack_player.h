@@ -0,0 +1,298 @@
+#pragma once
+
+#include "filter_pipeline.h"
+#include "height_pyramid.h"
+#include "tiff_decoder.h"
+#include "tile_grid.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One decoded page of a stack, with everything the renderer needs prepared
+struct StackFrame {
+    size_t index = 0;
+    HeightMap map;
+    SampleStats stats;
+    std::vector<float> filtered;      // Empty when no filter is set
+    SurfaceStats filteredStats;       // Of filtered
+    HeightPyramid pyramid;            // Of filtered when it is set, otherwise of map
+    std::vector<TileGrid> tileGrids;  // Level 0 plus one per pyramid level
+};
+
+// Plays back multi-page TIFF stacks (repeated measurements of one area).
+//
+// open() indexes the page offsets on the worker thread. The worker then keeps a
+// window of frames decoded ahead of the playback cursor, each with its LOD
+// pyramid and tile bounds already built, so showing a frame on the render thread
+// is only a buffer upload. Frames behind the cursor or beyond the window are
+// dropped, which bounds memory to lookahead frames.
+//
+// With a filter set, the worker also runs the pipeline over each frame and
+// builds the pyramid from the result, so playback shows filtered frames at the
+// same cost per shown frame. The pipeline's FFT plans are reused across frames.
+class StackPlayer {
+public:
+    StackPlayer() : thread(&StackPlayer::loop, this) {}
+
+    ~StackPlayer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            generation++;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    StackPlayer(const StackPlayer&) = delete;
+    StackPlayer& operator=(const StackPlayer&) = delete;
+
+    // Starts indexing path; frameCount() is 0 until that finishes. Clears the filter.
+    void open(const std::string& path, bool nativePrecision) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stackPath = path;
+            native = nativePrecision;
+            offsets.clear();
+            frames.clear();
+            stages.clear();
+            cursor = 0;
+            indexing = true;
+            errorText.clear();
+            generation++;
+            filterVersion++;
+        }
+        wake.notify_all();
+    }
+
+    // Stages run on frames decoded from now on, with the cutoffs they carry; an
+    // empty list plays the frames unfiltered. Frames decoded with other stages
+    // are dropped and decoded again.
+    void setFilter(const std::vector<FilterStage>& list, FftEngine::PlannerEffort effort,
+                   BandpassFilter::Padding padding, BandpassFilter::Window window) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (list == stages && effort == plannerEffort && padding == edgePadding && window == edgeWindow) return;
+            stages = list;
+            plannerEffort = effort;
+            edgePadding = padding;
+            edgeWindow = window;
+            frames.clear();
+            filterVersion++;
+        }
+        wake.notify_all();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stackPath.clear();
+        offsets.clear();
+        frames.clear();
+        indexing = false;
+        generation++;
+    }
+
+    size_t frameCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return offsets.size();
+    }
+
+    bool isIndexing() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return indexing;
+    }
+
+    std::string error() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return errorText;
+    }
+
+    // Moves the decode window to start at frame; with loop it wraps at the end
+    void seek(size_t frame, bool loop) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cursor = frame;
+            looping = loop;
+            dropOutsideWindowLocked();
+        }
+        wake.notify_all();
+    }
+
+    // Returns frame if it has been decoded and moves the window to the frame
+    // after it, so decoding continues ahead of playback
+    std::shared_ptr<StackFrame> take(size_t frame) {
+        std::shared_ptr<StackFrame> result;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = frames.find(frame);
+            if (it == frames.end()) return nullptr;
+            result = it->second;
+            frames.erase(it);
+            cursor = frame + 1;
+            if (cursor >= offsets.size() && looping) cursor = 0;
+            dropOutsideWindowLocked();
+        }
+        wake.notify_all();
+        return result;
+    }
+
+    // Decoded frames waiting in the window
+    size_t buffered() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames.size();
+    }
+
+    void setLookahead(size_t count) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            lookahead = std::max<size_t>(1, count);
+            dropOutsideWindowLocked();
+        }
+        wake.notify_all();
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::string stackPath;
+    bool native = false;
+    std::vector<uint64_t> offsets;
+    std::map<size_t, std::shared_ptr<StackFrame>> frames;
+    size_t cursor = 0;
+    size_t lookahead = 8;
+    bool looping = true;
+    bool indexing = false;
+    bool stopping = false;
+    std::string errorText;
+    uint64_t generation = 0;  // Bumped by open()/close() to discard work in flight
+    std::vector<FilterStage> stages;
+    FftEngine::PlannerEffort plannerEffort = FftEngine::Measure;
+    BandpassFilter::Padding edgePadding = BandpassFilter::MirrorPadding;
+    BandpassFilter::Window edgeWindow = BandpassFilter::NoWindow;
+    uint64_t filterVersion = 0;  // Bumped with the filter to discard frames filtered in flight
+    std::thread thread;
+
+    // Frame index at position i of the window, or false past the end
+    bool windowFrameLocked(size_t i, size_t& frame) const {
+        size_t count = offsets.size();
+        if (count == 0 || i >= std::min(lookahead, count)) return false;
+        frame = cursor + i;
+        if (frame >= count) {
+            if (!looping) return false;
+            frame %= count;
+        }
+        return true;
+    }
+
+    void dropOutsideWindowLocked() {
+        for (auto it = frames.begin(); it != frames.end();) {
+            bool inside = false;
+            size_t frame;
+            for (size_t i = 0; windowFrameLocked(i, frame); i++) {
+                if (frame == it->first) {
+                    inside = true;
+                    break;
+                }
+            }
+            it = inside ? std::next(it) : frames.erase(it);
+        }
+    }
+
+    // First frame of the window that is neither decoded nor being decoded
+    bool nextMissingLocked(size_t& frame) const {
+        for (size_t i = 0; windowFrameLocked(i, frame); i++) {
+            if (!frames.count(frame)) return true;
+        }
+        return false;
+    }
+
+    void loop() {
+        FilterPipeline pipeline;
+        FftEngine::PlannerEffort effort = FftEngine::Measure;
+        BandpassFilter::Padding padding = BandpassFilter::MirrorPadding;
+        BandpassFilter::Window window = BandpassFilter::NoWindow;
+        pipeline.setPlannerEffort(effort);
+        pipeline.setEdgeHandling(padding, window);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            size_t frame = 0;
+            wake.wait(lock, [&] { return stopping || indexing || nextMissingLocked(frame); });
+            if (stopping) break;
+            uint64_t startGeneration = generation;
+            std::string path = stackPath;
+
+            if (indexing) {
+                lock.unlock();
+                std::vector<uint64_t> found;
+                std::string indexError;
+                bool ok = TiffDecoder::pageOffsets(path, found, indexError);
+                lock.lock();
+                if (generation != startGeneration) continue;
+                indexing = false;
+                // Pages before a broken directory chain stay playable
+                offsets.swap(found);
+                if (!ok) errorText = indexError;
+                continue;
+            }
+
+            uint64_t offset = offsets[frame];
+            bool nativePrecision = native;
+            uint64_t startFilter = filterVersion;
+            std::vector<FilterStage> list = stages;
+            if (plannerEffort != effort) pipeline.setPlannerEffort(effort = plannerEffort);
+            if (edgePadding != padding || edgeWindow != window) {
+                pipeline.setEdgeHandling(padding = edgePadding, window = edgeWindow);
+            }
+            lock.unlock();
+            auto decoded = std::make_shared<StackFrame>();
+            decoded->index = frame;
+            TiffInfo info;
+            std::string decodeError;
+            bool ok = TiffDecoder::decode(path, decoded->map, info, decoded->stats, decodeError, nativePrecision, offset);
+            if (ok && !list.empty()) filter(pipeline, list, *decoded);
+            if (ok) {
+                HeightMap shown = decoded->filtered.empty()
+                                      ? decoded->map
+                                      : HeightMap::view(decoded->filtered.data(), decoded->map.width, decoded->map.height);
+                decoded->pyramid.build(shown);
+                decoded->tileGrids.resize(decoded->pyramid.levelCount() + 1);
+                decoded->tileGrids[0].build(shown);
+                for (size_t i = 0; i < decoded->pyramid.levelCount(); i++) {
+                    const HeightPyramid::Level& level = decoded->pyramid.level(i);
+                    decoded->tileGrids[i + 1].build(level.lo, level.hi, level.width, level.height);
+                }
+            }
+            lock.lock();
+            if (generation != startGeneration || filterVersion != startFilter) continue;
+            if (!ok) {
+                // Stop decoding this stack; the frames decoded so far stay playable
+                errorText = "Frame " + std::to_string(frame) + ": " + decodeError;
+                offsets.resize(frame);
+                dropOutsideWindowLocked();
+                continue;
+            }
+            frames[frame] = decoded;
+            dropOutsideWindowLocked();
+        }
+    }
+
+    // Runs the stages over a decoded frame; on failure the frame plays unfiltered
+    static void filter(FilterPipeline& pipeline, const std::vector<FilterStage>& list, StackFrame& frame) {
+        ScopedTimer timer("Stack filter");
+        pipeline.setStages(list);
+        pipeline.setInput(frame.map);
+        if (pipeline.run()) {
+            frame.filteredStats = pipeline.outputStats();
+            pipeline.takeOutput(frame.filtered);
+        }
+        // Earlier stage buffers and FFT plans stay allocated for the next frame
+        pipeline.setInput(HeightMap());
+    }
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "height_map.h"
+#include "profiler.h"
+#include "tile_grid.h"
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Draws a height map as a point cloud. Only the Z values are uploaded (one float
+// per sample); the vertex shader derives X/Y from gl_VertexID and the grid size,
+// so the surface always spans -5..5 in X and Y regardless of resolution. Integer
+// height maps are uploaded at their native precision as normalized attributes and
+// decoded in the shader.
+//
+// Level 0 holds the full-resolution grid; higher levels hold decimated copies
+// from HeightPyramid so distant views draw fewer points.
+class SurfaceRenderer {
+public:
+    struct GridBuffer {
+        GLuint vao = 0, vbo = 0;
+        uint32_t width = 0, height = 0;
+        HeightMap::Format format = HeightMap::Float32;
+        glm::vec2 decode = glm::vec2(1.0f, 0.0f);  // z = aZ * decode.x + decode.y
+    };
+    typedef std::vector<GridBuffer> LevelSet;
+
+    ~SurfaceRenderer() { destroy(); }
+
+    bool init() {
+        shaderProgram = createShaderProgram();
+        if (!shaderProgram) return false;
+        // Looked up once; the program is never relinked
+        uniforms.mvp = glGetUniformLocation(shaderProgram, "mvp");
+        uniforms.zMin = glGetUniformLocation(shaderProgram, "zMin");
+        uniforms.zMax = glGetUniformLocation(shaderProgram, "zMax");
+        uniforms.zScale = glGetUniformLocation(shaderProgram, "zScale");
+        uniforms.colorLUT = glGetUniformLocation(shaderProgram, "colorLUT");
+        uniforms.gridSize = glGetUniformLocation(shaderProgram, "gridSize");
+        uniforms.zDecode = glGetUniformLocation(shaderProgram, "zDecode");
+        return true;
+    }
+
+    void destroy() {
+        trimLevels(0);
+        if (shaderProgram) glDeleteProgram(shaderProgram);
+        shaderProgram = 0;
+    }
+
+    void upload(size_t level, const float* z, uint32_t w, uint32_t h) {
+        upload(level, HeightMap::view(z, w, h));
+    }
+
+    // Uploads a height map into the given level in its storage format. The buffer
+    // is only reallocated when the size or format changes; otherwise it is updated
+    // in place.
+    void upload(size_t level, const HeightMap& map) {
+        ScopedTimer timer("GPU upload");
+        while (levels.size() <= level) levels.push_back(createGridBuffer());
+        GridBuffer& grid = levels[level];
+        size_t bytes = map.size() * HeightMap::sampleSize(map.format);
+        glBindVertexArray(grid.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+        if (map.width != grid.width || map.height != grid.height || map.format != grid.format) {
+            glBufferData(GL_ARRAY_BUFFER, bytes, map.data(), GL_DYNAMIC_DRAW);
+            setAttribFormat(map.format);
+            grid.width = map.width;
+            grid.height = map.height;
+            grid.format = map.format;
+        } else {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, map.data());
+        }
+        grid.decode = decodeFor(map);
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            std::cerr << "OpenGL error after uploading Z map: " << err << std::endl;
+        }
+    }
+
+    // Rewrites only the samples of rect, one buffer range per row (a single range
+    // when rect spans whole rows). A level of another size or format is
+    // uploaded in full instead.
+    void update(size_t level, const HeightMap& map, const GridRect& rect) {
+        if (level >= levels.size() || map.width != levels[level].width || map.height != levels[level].height ||
+            map.format != levels[level].format) {
+            upload(level, map);
+            return;
+        }
+        if (rect.empty()) return;
+        ScopedTimer timer("GPU upload");
+        GridBuffer& grid = levels[level];
+        size_t sample = HeightMap::sampleSize(map.format);
+        const uint8_t* data = static_cast<const uint8_t*>(map.data());
+        glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+        if (rect.width() == map.width) {
+            size_t offset = static_cast<size_t>(rect.y0) * map.width * sample;
+            glBufferSubData(GL_ARRAY_BUFFER, offset, rect.size() * sample, data + offset);
+        } else {
+            for (uint32_t y = rect.y0; y < rect.y1; y++) {
+                size_t offset = (static_cast<size_t>(y) * map.width + rect.x0) * sample;
+                glBufferSubData(GL_ARRAY_BUFFER, offset, rect.width() * sample, data + offset);
+            }
+        }
+        grid.decode = decodeFor(map);
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            std::cerr << "OpenGL error after updating Z map region: " << err << std::endl;
+        }
+    }
+
+    // Uploads a map that replaces the level every frame, e.g. during stack
+    // playback. Each streamed level has two buffers: the new data goes into the
+    // one that was not drawn last, through an invalidating map so the driver never
+    // waits for the GPU to finish reading it, and the two are then swapped.
+    void stream(size_t level, const HeightMap& map) {
+        ScopedTimer timer("GPU stream");
+        while (levels.size() <= level) levels.push_back(createGridBuffer());
+        while (spares.size() <= level) spares.push_back(createGridBuffer());
+        GridBuffer& grid = spares[level];
+        size_t bytes = map.size() * HeightMap::sampleSize(map.format);
+        glBindVertexArray(grid.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+        if (map.width != grid.width || map.height != grid.height || map.format != grid.format) {
+            glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+            setAttribFormat(map.format);
+            grid.width = map.width;
+            grid.height = map.height;
+            grid.format = map.format;
+        }
+        void* dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst) {
+            std::memcpy(dst, map.data(), bytes);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        } else {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, map.data());
+        }
+        grid.decode = decodeFor(map);
+        std::swap(levels[level], spares[level]);
+    }
+
+    void stream(size_t level, const float* z, uint32_t w, uint32_t h) {
+        stream(level, HeightMap::view(z, w, h));
+    }
+
+    // Releases levels at index count and above
+    void trimLevels(size_t count) {
+        for (LevelSet* set : {&levels, &spares}) {
+            while (set->size() > count) {
+                glDeleteBuffers(1, &set->back().vbo);
+                glDeleteVertexArrays(1, &set->back().vao);
+                set->pop_back();
+            }
+        }
+    }
+
+    // Frees the second buffers kept for streaming
+    void releaseSpares() { deleteLevels(spares); }
+
+    // Draws one level, restricted to the given row ranges unless they cover everything
+    void draw(const glm::mat4& mvp, float zMin, float zMax, float zScale, int colorLUT, size_t level = 0,
+              const DrawRanges* ranges = nullptr) {
+        if (level >= levels.size()) return;
+        const GridBuffer& grid = levels[level];
+        if (grid.width == 0 || grid.height == 0) return;
+        glUseProgram(shaderProgram);
+        glUniformMatrix4fv(uniforms.mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+        glUniform1f(uniforms.zMin, zMin);
+        glUniform1f(uniforms.zMax, zMax);
+        glUniform1f(uniforms.zScale, zScale);
+        glUniform1i(uniforms.colorLUT, colorLUT);
+        glUniform2i(uniforms.gridSize, (GLint)grid.width, (GLint)grid.height);
+        glUniform2f(uniforms.zDecode, grid.decode.x, grid.decode.y);
+
+        glBindVertexArray(grid.vao);
+        if (ranges && !ranges->all) {
+            if (!ranges->firsts.empty()) {
+                glMultiDrawArrays(GL_POINTS, ranges->firsts.data(), ranges->counts.data(),
+                                  static_cast<GLsizei>(ranges->firsts.size()));
+            }
+        } else {
+            glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(static_cast<size_t>(grid.width) * grid.height));
+        }
+    }
+
+    // Coarsest level whose larger side still has at least surfacePixels samples
+    size_t levelFor(float surfacePixels) const {
+        size_t level = 0;
+        while (level + 1 < levels.size() &&
+               std::max(levels[level + 1].width, levels[level + 1].height) >= surfacePixels) {
+            level++;
+        }
+        return level;
+    }
+
+    size_t levelCount() const { return levels.size(); }
+    uint32_t gridWidth(size_t level = 0) const { return level < levels.size() ? levels[level].width : 0; }
+    uint32_t gridHeight(size_t level = 0) const { return level < levels.size() ? levels[level].height : 0; }
+
+    size_t gpuBytes() const { return levelBytes(levels) + levelBytes(spares); }
+
+    // Hands the uploaded levels to the caller, leaving the renderer empty, so a
+    // surface can be kept on the GPU and attached again without re-uploading
+    LevelSet detachLevels() {
+        releaseSpares();
+        LevelSet detached;
+        detached.swap(levels);
+        return detached;
+    }
+
+    // Replaces the current levels; the renderer takes ownership of the buffers
+    void attachLevels(LevelSet&& attached) {
+        trimLevels(0);
+        levels = std::move(attached);
+    }
+
+    static void deleteLevels(LevelSet& set) {
+        for (auto& grid : set) {
+            glDeleteBuffers(1, &grid.vbo);
+            glDeleteVertexArrays(1, &grid.vao);
+        }
+        set.clear();
+    }
+
+    static size_t levelBytes(const LevelSet& set) {
+        size_t total = 0;
+        for (const auto& grid : set) {
+            total += static_cast<size_t>(grid.width) * grid.height * HeightMap::sampleSize(grid.format);
+        }
+        return total;
+    }
+
+private:
+    struct Uniforms {
+        GLint mvp = -1, zMin = -1, zMax = -1, zScale = -1, colorLUT = -1, gridSize = -1, zDecode = -1;
+    };
+
+    GLuint shaderProgram = 0;
+    Uniforms uniforms;
+    LevelSet levels;
+    LevelSet spares;  // Back buffers of streamed levels
+
+    // Normalized integers arrive in the shader as v / max
+    static glm::vec2 decodeFor(const HeightMap& map) {
+        switch (map.format) {
+            case HeightMap::UInt16: return glm::vec2(map.scale * 65535.0f, map.offset);
+            case HeightMap::UInt8: return glm::vec2(map.scale * 255.0f, map.offset);
+            default: return glm::vec2(1.0f, 0.0f);
+        }
+    }
+
+    GridBuffer createGridBuffer() {
+        GridBuffer grid;
+        glGenVertexArrays(1, &grid.vao);
+        glGenBuffers(1, &grid.vbo);
+        glBindVertexArray(grid.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+        setAttribFormat(HeightMap::Float32);
+        glEnableVertexAttribArray(0);
+        return grid;
+    }
+
+    // Points attribute 0 of the bound VAO at the bound buffer
+    static void setAttribFormat(HeightMap::Format format) {
+        switch (format) {
+            case HeightMap::UInt16: glVertexAttribPointer(0, 1, GL_UNSIGNED_SHORT, GL_TRUE, 2, (void*)0); break;
+            case HeightMap::UInt8: glVertexAttribPointer(0, 1, GL_UNSIGNED_BYTE, GL_TRUE, 1, (void*)0); break;
+            default: glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0); break;
+        }
+    }
+
+    const char* vertexShaderSource = R"(
+        #version 130
+        attribute float aZ;
+        uniform mat4 mvp;
+        uniform float zMin;
+        uniform float zMax;
+        uniform float zScale;
+        uniform int colorLUT;
+        uniform ivec2 gridSize;
+        uniform vec2 zDecode;
+        varying vec3 vColor;
+        void main() {
+            float z = aZ * zDecode.x + zDecode.y;
+            // Row-major grid: X/Y follow from the sample index
+            int col = gl_VertexID % gridSize.x;
+            int row = gl_VertexID / gridSize.x;
+            float x = (float(col) - float(gridSize.x) / 2.0) * (10.0 / float(gridSize.x));
+            float y = (float(row) - float(gridSize.y) / 2.0) * (10.0 / float(gridSize.y));
+            vec3 scaledPos = vec3(x, y, z * zScale);
+            gl_Position = mvp * vec4(scaledPos, 1.0);
+            float t = clamp((z - zMin) / (zMax - zMin), 0.0, 1.0);
+            if (colorLUT == 0) {  // Jet (more gradations)
+                if (t < 0.25) vColor = mix(vec3(0,0,1), vec3(0,0.5,1), t/0.25);
+                else if (t < 0.5) vColor = mix(vec3(0,0.5,1), vec3(0,1,1), (t-0.25)/0.25);
+                else if (t < 0.75) vColor = mix(vec3(0,1,1), vec3(1,1,0), (t-0.5)/0.25);
+                else vColor = mix(vec3(1,1,0), vec3(1,0,0), (t-0.75)/0.25);
+            } else if (colorLUT == 1) {  // Viridis (more gradations)
+                if (t < 0.33) vColor = mix(vec3(0.267,0.676,0.997), vec3(0.043,0.141,0.278), t/0.33);
+                else if (t < 0.66) vColor = mix(vec3(0.043,0.141,0.278), vec3(0.5,0.5,0.5), (t-0.33)/0.33);
+                else vColor = mix(vec3(0.5,0.5,0.5), vec3(1,0.9,0), (t-0.66)/0.34);
+            } else if (colorLUT == 2) {  // Plasma
+                vColor = vec3(0.908*t + 0.051, 0.463*t + 0.281, 0.996*t + 0.133);
+            } else if (colorLUT == 3) {  // Hot
+                vColor = vec3(3.0*t, t > 0.33 ? 3.0*(t-0.33) : 0.0, t > 0.66 ? 3.0*(t-0.66) : 0.0);
+            } else if (colorLUT == 4) {  // Cool
+                vColor = vec3(t, 1.0-t, 1.0);
+            } else {  // Turbo
+                float r = 0.1357 + t * (4.5970 - t * (42.8537 - t * (151.0138 - t * (218.7175 - t * 115.2778))));
+                float g = 0.0914 + t * (2.1855 + t * (4.2596 - t * (71.3487 - t * (206.5138 - t * 165.4033))));
+                float b = 0.1066 + t * (5.9399 - t * (49.9290 - t * (171.2617 - t * (258.5662 - t * 136.5015))));
+                vColor = vec3(r, g, b);
+            }
+            vColor = clamp(vColor, 0.0, 1.0);
+        }
+    )";
+
+    const char* fragmentShaderSource = R"(
+        #version 130
+        varying vec3 vColor;
+        void main() {
+            gl_FragColor = vec4(vColor, 1.0);
+        }
+    )";
+
+    GLuint createShaderProgram() {
+        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
+        glCompileShader(vertexShader);
+        GLint success;
+        glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            char infoLog[512];
+            glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+            std::cerr << "Vertex shader compilation failed: " << infoLog << std::endl;
+            return 0;
+        }
+
+        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+        glCompileShader(fragmentShader);
+        glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            char infoLog[512];
+            glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
+            std::cerr << "Fragment shader compilation failed: " << infoLog << std::endl;
+            glDeleteShader(vertexShader);
+            return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glBindAttribLocation(program, 0, "aZ");
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            char infoLog[512];
+            glGetProgramInfoLog(program, 512, NULL, infoLog);
+            std::cerr << "Shader program linking failed: " << infoLog << std::endl;
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            return 0;
+        }
+
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return program;
+    }
+};
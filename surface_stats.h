@@ -0,0 +1,118 @@
+#pragma once
+
+#include "height_map.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Summary statistics of a height map over its finite samples, including the
+// ISO 25178 areal roughness parameters. These are taken about the mean height,
+// so form should be removed first (e.g. by a Level stage) for them to describe
+// roughness rather than tilt.
+struct SurfaceStats {
+    uint64_t valid = 0, invalid = 0;
+    float min = 0.0f, max = 0.0f;
+    double mean = 0.0;
+    double stdDev = 0.0;  // Population standard deviation about the mean
+
+    double sa = 0.0;   // Arithmetic mean of |z - mean|
+    double sq = 0.0;   // Root mean square of z - mean (equal to stdDev)
+    double sp = 0.0;   // Highest peak above the mean
+    double sv = 0.0;   // Depth of the deepest valley below the mean
+    double sz = 0.0;   // Maximum height, sp + sv
+    double ssk = 0.0;  // Skewness, third central moment / sq^3
+    double sku = 0.0;  // Kurtosis, fourth central moment / sq^4 (3 for a Gaussian surface)
+
+    // Two passes over the map: mean first, then the central moments about it,
+    // which avoids the cancellation of raw power sums. Each chunk accumulates in
+    // double and partials are combined in chunk order, so results do not depend
+    // on the thread count.
+    static SurfaceStats compute(const HeightMap& map) {
+        SurfaceStats stats;
+        size_t count = map.size();
+        size_t chunks = chunkCount(count);
+        struct Partial {
+            double sum = 0.0;
+            double absolute = 0.0, squares = 0.0, cubes = 0.0, fourths = 0.0;
+            uint64_t valid = 0;
+            float min = std::numeric_limits<float>::max();
+            float max = std::numeric_limits<float>::lowest();
+        };
+        std::vector<Partial> partial(chunks);
+
+        parallelFor(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+            Partial& p = partial[chunk];
+            const size_t block = 4096;
+            float scratch[block];
+            for (size_t start = begin; start < end; start += block) {
+                size_t n = std::min(block, end - start);
+                const float* z = map.read(start, n, scratch);
+                for (size_t i = 0; i < n; i++) {
+                    if (!std::isfinite(z[i])) continue;
+                    p.sum += z[i];
+                    p.valid++;
+                    p.min = std::min(p.min, z[i]);
+                    p.max = std::max(p.max, z[i]);
+                }
+            }
+        });
+        double sum = 0.0;
+        stats.min = std::numeric_limits<float>::max();
+        stats.max = std::numeric_limits<float>::lowest();
+        for (const Partial& p : partial) {
+            sum += p.sum;
+            stats.valid += p.valid;
+            stats.min = std::min(stats.min, p.min);
+            stats.max = std::max(stats.max, p.max);
+        }
+        stats.invalid = count - stats.valid;
+        if (stats.valid == 0) {
+            stats.min = stats.max = 0.0f;
+            return stats;
+        }
+        stats.mean = sum / stats.valid;
+
+        double mean = stats.mean;
+        parallelFor(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+            Partial& p = partial[chunk];
+            const size_t block = 4096;
+            float scratch[block];
+            for (size_t start = begin; start < end; start += block) {
+                size_t n = std::min(block, end - start);
+                const float* z = map.read(start, n, scratch);
+                for (size_t i = 0; i < n; i++) {
+                    if (!std::isfinite(z[i])) continue;
+                    double d = z[i] - mean;
+                    double d2 = d * d;
+                    p.absolute += std::abs(d);
+                    p.squares += d2;
+                    p.cubes += d2 * d;
+                    p.fourths += d2 * d2;
+                }
+            }
+        });
+        double absolute = 0.0, squares = 0.0, cubes = 0.0, fourths = 0.0;
+        for (const Partial& p : partial) {
+            absolute += p.absolute;
+            squares += p.squares;
+            cubes += p.cubes;
+            fourths += p.fourths;
+        }
+        double n = static_cast<double>(stats.valid);
+        stats.stdDev = std::sqrt(squares / n);
+        stats.sa = absolute / n;
+        stats.sq = stats.stdDev;
+        stats.sp = stats.max - stats.mean;
+        stats.sv = stats.mean - stats.min;
+        stats.sz = stats.sp + stats.sv;
+        if (stats.sq > 0.0) {
+            double sq2 = stats.sq * stats.sq;
+            stats.ssk = cubes / n / (sq2 * stats.sq);
+            stats.sku = fourths / n / (sq2 * sq2);
+        }
+        return stats;
+    }
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "height_map.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <tiffio.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Layout and sample format of one TIFF directory
+struct TiffInfo {
+    uint32_t width = 0, height = 0;
+    uint16_t bitsPerSample = 0, sampleFormat = SAMPLEFORMAT_UINT, samplesPerPixel = 1;
+    uint16_t compression = COMPRESSION_NONE;
+    bool tiled = false;
+    bool bigTiff = false;
+    uint32_t blockWidth = 0, blockHeight = 0;  // Tile size, or width x rows per strip
+    uint32_t blockCount = 0;                   // Number of strips or tiles
+};
+
+// Range and invalid (NaN/inf) count gathered while converting samples. Invalid
+// samples are excluded from min/max.
+struct SampleStats {
+    float min = std::numeric_limits<float>::max();
+    float max = std::numeric_limits<float>::lowest();
+    size_t invalid = 0;
+
+    void merge(const SampleStats& other) {
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        invalid += other.invalid;
+    }
+
+    // Called once every sample is in: a scan without a single finite sample gets
+    // a 0..0 range instead of the FLT_MAX/lowest() sentinels
+    void finish() {
+        if (min > max) min = max = 0.0f;
+    }
+};
+
+// Decodes single-channel TIFF height maps into floats. Strips or tiles are
+// independent, so they are decoded concurrently, each worker reading through its
+// own TIFF handle (libtiff handles are not thread-safe) straight into the output.
+// Compression (LZW, Deflate, ...) and BigTIFF are handled by libtiff itself.
+// Multi-page files are addressed by page offset.
+// Format conversion, min/max and invalid-sample tracking are fused into a single
+// vectorized pass per block row while the block is still in cache. Integer
+// samples can be kept at their native precision instead of widened to floats.
+class TiffDecoder {
+public:
+    // Converts n samples of one block row into the output format and accumulates
+    // their stats; chosen once per file
+    typedef void (*ConvertFn)(const void* src, void* dst, size_t n, SampleStats& stats);
+
+    static bool readInfo(TIFF* tif, TiffInfo& info, std::string& error) {
+        if (!TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &info.width) ||
+            !TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &info.height) ||
+            !TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &info.bitsPerSample)) {
+            error = "Failed to read TIFF metadata";
+            return false;
+        }
+        TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &info.sampleFormat);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &info.samplesPerPixel);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &info.compression);
+        info.bigTiff = TIFFIsBigTIFF(tif) != 0;
+        info.tiled = TIFFIsTiled(tif) != 0;
+        if (info.tiled) {
+            TIFFGetField(tif, TIFFTAG_TILEWIDTH, &info.blockWidth);
+            TIFFGetField(tif, TIFFTAG_TILELENGTH, &info.blockHeight);
+            info.blockCount = TIFFNumberOfTiles(tif);
+        } else {
+            uint32_t rowsPerStrip = info.height;
+            TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+            info.blockWidth = info.width;
+            info.blockHeight = std::min(rowsPerStrip, info.height);
+            info.blockCount = TIFFNumberOfStrips(tif);
+        }
+
+        if (info.samplesPerPixel != 1) {
+            error = "Only single-channel TIFFs are supported";
+            return false;
+        }
+        if (!converterFor(info)) {
+            error = "Unsupported TIFF format (" + std::to_string(info.bitsPerSample) + " bits, format " +
+                    std::to_string(info.sampleFormat) + ")";
+            return false;
+        }
+        if (info.width == 0 || info.height == 0 || info.blockWidth == 0 || info.blockHeight == 0) {
+            error = "Invalid TIFF dimensions";
+            return false;
+        }
+        return true;
+    }
+
+    // directory is a page offset from pageOffsets(); 0 reads the first page
+    static bool readInfo(const std::string& path, TiffInfo& info, std::string& error, uint64_t directory = 0) {
+        TIFF* tif = openDirectory(path, directory, error);
+        if (!tif) return false;
+        bool ok = readInfo(tif, info, error);
+        TIFFClose(tif);
+        return ok;
+    }
+
+    // File offsets of every page (directory) in path, in order. Seeking by offset
+    // is constant time, unlike TIFFSetDirectory which walks the directory chain.
+    // If the chain is broken (a bad next-directory offset or a loop), returns
+    // false with the pages before the break in offsets.
+    static bool pageOffsets(const std::string& path, std::vector<uint64_t>& offsets, std::string& error) {
+        offsets.clear();
+        TIFF* tif = TIFFOpen(path.c_str(), "r");
+        if (!tif) {
+            error = "Failed to open TIFF file";
+            return false;
+        }
+        while (true) {
+            offsets.push_back(TIFFCurrentDirOffset(tif));
+            if (TIFFLastDirectory(tif)) break;
+            if (!TIFFReadDirectory(tif)) {
+                error = "Corrupt directory chain after page " + std::to_string(offsets.size());
+                TIFFClose(tif);
+                return false;
+            }
+        }
+        TIFFClose(tif);
+        return true;
+    }
+
+    // Decodes one page of path (the first by default) into out. With
+    // nativePrecision, 8/16-bit integer samples are stored as-is and mapped to
+    // -1..1 through the map's scale/offset; everything else is stored as floats.
+    static bool decode(const std::string& path, HeightMap& out, TiffInfo& info, SampleStats& stats,
+                       std::string& error, bool nativePrecision = false, uint64_t directory = 0) {
+        ScopedTimer timer("TIFF decode");
+        if (!readInfo(path, info, error, directory)) return false;
+        ConvertFn convert = converterFor(info, nativePrecision);
+        bool integer = info.sampleFormat == SAMPLEFORMAT_UINT;
+        if (nativePrecision && integer && info.bitsPerSample == 16) {
+            out.allocate(info.width, info.height, HeightMap::UInt16, 2.0f / 65535.0f, -1.0f);
+        } else if (nativePrecision && integer && info.bitsPerSample == 8) {
+            out.allocate(info.width, info.height, HeightMap::UInt8, 2.0f / 255.0f, -1.0f);
+        } else {
+            out.allocate(info.width, info.height, HeightMap::Float32);
+        }
+        size_t outSampleSize = HeightMap::sampleSize(out.format);
+        uint8_t* outData = static_cast<uint8_t*>(out.mutableData());
+
+        ThreadPool& pool = decodePool();
+        size_t workers = std::min<size_t>(pool.size(), info.blockCount);
+        std::atomic<uint32_t> nextBlock{0};
+        std::atomic<bool> failed{false};
+        std::mutex errorMutex;
+        stats = SampleStats();
+
+        pool.run(workers, [&](size_t) {
+            std::string openError;
+            TIFF* tif = openDirectory(path, directory, openError);
+            if (!tif) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!failed.exchange(true)) error = openError;
+                return;
+            }
+            tmsize_t blockSize = info.tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+            std::vector<char> buffer(blockSize);
+            size_t bytesPerSample = info.bitsPerSample / 8;
+            uint32_t blocksAcross = (info.width + info.blockWidth - 1) / info.blockWidth;
+            SampleStats local;
+
+            for (uint32_t block = nextBlock++; block < info.blockCount && !failed; block = nextBlock++) {
+                tmsize_t read = info.tiled ? TIFFReadEncodedTile(tif, block, buffer.data(), blockSize)
+                                           : TIFFReadEncodedStrip(tif, block, buffer.data(), blockSize);
+                if (read < 0) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!failed.exchange(true)) {
+                        error = "Failed to read " + std::string(info.tiled ? "tile " : "strip ") + std::to_string(block);
+                    }
+                    break;
+                }
+
+                // Strips are full-width blocks; tiles are clipped at the right and bottom edges
+                uint32_t x0 = (block % blocksAcross) * info.blockWidth;
+                uint32_t y0 = (block / blocksAcross) * info.blockHeight;
+                uint32_t cols = std::min(info.blockWidth, info.width - x0);
+                uint32_t rows = std::min(info.blockHeight, info.height - y0);
+                for (uint32_t r = 0; r < rows; r++) {
+                    const char* src = buffer.data() + static_cast<size_t>(r) * info.blockWidth * bytesPerSample;
+                    uint8_t* dst = outData + (static_cast<size_t>(y0 + r) * info.width + x0) * outSampleSize;
+                    convert(src, dst, cols, local);
+                }
+            }
+            TIFFClose(tif);
+            std::lock_guard<std::mutex> lock(errorMutex);
+            stats.merge(local);
+        });
+        stats.finish();
+        return !failed;
+    }
+
+    static ConvertFn converterFor(const TiffInfo& info, bool nativePrecision = false) {
+        if (info.bitsPerSample == 32 && info.sampleFormat == SAMPLEFORMAT_IEEEFP) return convertFloat32;
+        if (info.bitsPerSample == 16 && info.sampleFormat == SAMPLEFORMAT_UINT) {
+            return nativePrecision ? copyUnsigned<uint16_t> : convertUnsigned<uint16_t>;
+        }
+        if (info.bitsPerSample == 8 && info.sampleFormat == SAMPLEFORMAT_UINT) {
+            return nativePrecision ? copyUnsigned<uint8_t> : convertUnsigned<uint8_t>;
+        }
+        return nullptr;
+    }
+
+private:
+    static TIFF* openDirectory(const std::string& path, uint64_t directory, std::string& error) {
+        TIFF* tif = TIFFOpen(path.c_str(), "r");
+        if (!tif) {
+            error = "Failed to open TIFF file";
+            return nullptr;
+        }
+        if (directory != 0 && !TIFFSetSubDirectory(tif, directory)) {
+            TIFFClose(tif);
+            error = "Failed to read TIFF page";
+            return nullptr;
+        }
+        return tif;
+    }
+
+    static ThreadPool& decodePool() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static void convertFloat32(const void* src, void* out, size_t n, SampleStats& stats) {
+        const float* s = static_cast<const float*>(src);  // Raw μm
+        float* dst = static_cast<float*>(out);
+        size_t i = 0;
+        float mn = stats.min, mx = stats.max;
+        size_t invalid = 0;
+#if defined(__SSE2__)
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+        __m128 vmin = _mm_set1_ps(mn), vmax = _mm_set1_ps(mx);
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(s + i);
+            _mm_storeu_ps(dst + i, v);
+            // Finite lanes: |v| < inf is false for both NaN and inf
+            __m128 valid = _mm_cmplt_ps(_mm_and_ps(v, absMask), inf);
+            vmin = _mm_min_ps(vmin, _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, vmin)));
+            vmax = _mm_max_ps(vmax, _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, vmax)));
+            invalid += 4 - __builtin_popcount(_mm_movemask_ps(valid));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, vmin);
+        mn = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, vmax);
+        mx = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+        for (; i < n; i++) {
+            float z = s[i];
+            dst[i] = z;
+            if (std::isfinite(z)) {
+                mn = std::min(mn, z);
+                mx = std::max(mx, z);
+            } else {
+                invalid++;
+            }
+        }
+        stats.min = mn;
+        stats.max = mx;
+        stats.invalid += invalid;
+    }
+
+    // Integer formats are mapped to -1..1. The range is tracked on the integer
+    // samples, which vectorizes cleanly, and converted once per row.
+    template <typename T>
+    static void convertUnsigned(const void* src, void* out, size_t n, SampleStats& stats) {
+        const T* s = static_cast<const T*>(src);
+        float* dst = static_cast<float*>(out);
+        const float scale = 2.0f / std::numeric_limits<T>::max();
+        T lo = std::numeric_limits<T>::max(), hi = 0;
+        for (size_t i = 0; i < n; i++) {
+            T v = s[i];
+            dst[i] = v * scale - 1.0f;
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+        mergeUnsignedRange<T>(lo, hi, n, stats);
+    }
+
+    // Native precision: samples are copied unchanged, only the range is tracked
+    template <typename T>
+    static void copyUnsigned(const void* src, void* out, size_t n, SampleStats& stats) {
+        const T* s = static_cast<const T*>(src);
+        std::memcpy(out, src, n * sizeof(T));
+        T lo = std::numeric_limits<T>::max(), hi = 0;
+        for (size_t i = 0; i < n; i++) {
+            lo = s[i] < lo ? s[i] : lo;
+            hi = s[i] > hi ? s[i] : hi;
+        }
+        mergeUnsignedRange<T>(lo, hi, n, stats);
+    }
+
+    template <typename T>
+    static void mergeUnsignedRange(T lo, T hi, size_t n, SampleStats& stats) {
+        if (n == 0) return;
+        const float scale = 2.0f / std::numeric_limits<T>::max();
+        stats.min = std::min(stats.min, lo * scale - 1.0f);
+        stats.max = std::max(stats.max, hi * scale - 1.0f);
+    }
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "height_map.h"
+#include <tiffio.h>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes height maps as single-channel TIFFs in their storage format: float32,
+// or uint16/uint8 for maps kept at native precision (their scale/offset is not
+// stored, so readers see the raw integers just like in the source file).
+// Files that would exceed 4 GiB are written as BigTIFF.
+class TiffWriter {
+public:
+    static bool write(const std::string& path, const HeightMap& map, std::string& error,
+                      uint16_t compression = COMPRESSION_NONE) {
+        if (map.empty()) {
+            error = "Nothing to write";
+            return false;
+        }
+        size_t sampleSize = HeightMap::sampleSize(map.format);
+        bool big = map.size() * sampleSize > (size_t(4) << 30) - (size_t(64) << 20);
+        TIFF* tif = TIFFOpen(path.c_str(), big ? "w8" : "w");
+        if (!tif) {
+            error = "Failed to create TIFF file";
+            return false;
+        }
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, map.width);
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, map.height);
+        TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, static_cast<uint16_t>(sampleSize * 8));
+        TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, map.format == HeightMap::Float32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+        if (compression != COMPRESSION_NONE) {
+            TIFFSetField(tif, TIFFTAG_PREDICTOR, map.format == HeightMap::Float32 ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL);
+        }
+        // Strips of about 256 KiB keep parallel readers busy
+        size_t rowBytes = static_cast<size_t>(map.width) * sampleSize;
+        uint32_t rowsPerStrip = static_cast<uint32_t>(std::max<size_t>(1, (256 * 1024) / rowBytes));
+        rowsPerStrip = std::min(rowsPerStrip, map.height);
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+
+        // Encoding may modify the buffer (predictors), so strips are copied first
+        std::vector<uint8_t> strip(rowBytes * rowsPerStrip);
+        const uint8_t* samples = static_cast<const uint8_t*>(map.data());
+        uint32_t strips = (map.height + rowsPerStrip - 1) / rowsPerStrip;
+        for (uint32_t s = 0; s < strips; s++) {
+            uint32_t rows = std::min(rowsPerStrip, map.height - s * rowsPerStrip);
+            size_t bytes = rowBytes * rows;
+            std::copy(samples + rowBytes * s * rowsPerStrip, samples + rowBytes * s * rowsPerStrip + bytes, strip.data());
+            if (TIFFWriteEncodedStrip(tif, s, strip.data(), static_cast<tmsize_t>(bytes)) < 0) {
+                TIFFClose(tif);
+                error = "Failed to write strip " + std::to_string(s);
+                return false;
+            }
+        }
+        TIFFClose(tif);
+        return true;
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "height_map.h"
+#include "parallel.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Row ranges of a row-major grid to draw with glMultiDrawArrays
+struct DrawRanges {
+    std::vector<int> firsts;
+    std::vector<int> counts;
+    size_t points = 0;
+    size_t visibleTiles = 0;
+    bool all = true;  // Every tile is visible; a single draw covers the grid
+};
+
+// Splits a row-major height grid into fixed-size tiles with precomputed Z bounds
+// and culls them against the view frustum. X/Y bounds follow from the grid layout
+// used by the renderer (-5..5 across each axis); Z bounds are stored unscaled so
+// changing zScale only rescales them at cull time.
+class TileGrid {
+public:
+    static constexpr uint32_t TileSize = 128;
+
+    // Full-resolution level: every sample bounds itself
+    void build(const HeightMap& map) {
+        buildRows(map.width, map.height, [&map](uint32_t y, float* scratch, const float*& lo, const float*& hi) {
+            lo = hi = map.row(y, scratch);
+        });
+    }
+
+    // Decimated level: per-sample bounds from the pyramid's min/max
+    void build(const float* lo, const float* hi, uint32_t w, uint32_t h) {
+        buildRows(w, h, [lo, hi, w](uint32_t y, float*, const float*& loRow, const float*& hiRow) {
+            loRow = lo + static_cast<size_t>(y) * w;
+            hiRow = hi + static_cast<size_t>(y) * w;
+        });
+    }
+
+    // Recomputes the bounds of the tiles overlapping rect after the samples there
+    // changed; a grid of another size is rebuilt
+    void update(const HeightMap& map, const GridRect& rect) {
+        if (map.width != width || map.height != height) return build(map);
+        updateRows(rect, [&map](uint32_t y, float* scratch, const float*& lo, const float*& hi) {
+            lo = hi = map.row(y, scratch);
+        });
+    }
+
+    void update(const float* lo, const float* hi, uint32_t w, uint32_t h, const GridRect& rect) {
+        if (w != width || h != height) return build(lo, hi, w, h);
+        updateRows(rect, [lo, hi, w](uint32_t y, float*, const float*& loRow, const float*& hiRow) {
+            loRow = lo + static_cast<size_t>(y) * w;
+            hiRow = hi + static_cast<size_t>(y) * w;
+        });
+    }
+
+    template <typename RowFn>
+    void buildRows(uint32_t w, uint32_t h, RowFn fetchRow) {
+        width = w;
+        height = h;
+        tilesX = (w + TileSize - 1) / TileSize;
+        tilesY = (h + TileSize - 1) / TileSize;
+        tileMin.resize(static_cast<size_t>(tilesX) * tilesY);
+        tileMax.resize(tileMin.size());
+        computeTiles(0, tilesY, 0, tilesX, fetchRow);
+    }
+
+    template <typename RowFn>
+    void updateRows(const GridRect& rect, RowFn fetchRow) {
+        if (rect.empty()) return;
+        computeTiles(rect.y0 / TileSize, (std::min(rect.y1, height) + TileSize - 1) / TileSize, rect.x0 / TileSize,
+                     (std::min(rect.x1, width) + TileSize - 1) / TileSize, fetchRow);
+    }
+
+    size_t tileCount() const { return tileMin.size(); }
+
+    // Fills ranges with one entry per grid row of every run of horizontally
+    // adjacent visible tiles.
+    void cull(const glm::mat4& mvp, float zScale, DrawRanges& ranges) const {
+        ranges.firsts.clear();
+        ranges.counts.clear();
+        ranges.points = 0;
+        ranges.visibleTiles = 0;
+        ranges.all = false;
+
+        // Frustum planes (Gribb-Hartmann) from the rows of the column-major matrix
+        glm::vec4 planes[6];
+        for (int i = 0; i < 3; i++) {
+            glm::vec4 row(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+            glm::vec4 w(mvp[0][3], mvp[1][3], mvp[2][3], mvp[3][3]);
+            planes[2 * i] = w + row;
+            planes[2 * i + 1] = w - row;
+        }
+
+        float sx = 10.0f / width, sy = 10.0f / height;
+        std::vector<char> visible(tilesX);
+        for (uint32_t ty = 0; ty < tilesY; ty++) {
+            uint32_t y0 = ty * TileSize;
+            uint32_t y1 = std::min(y0 + TileSize, height);
+            float minY = (y0 - height / 2.0f) * sy;
+            float maxY = (y1 - 1 - height / 2.0f) * sy;
+            for (uint32_t tx = 0; tx < tilesX; tx++) {
+                uint32_t x0 = tx * TileSize;
+                uint32_t x1 = std::min(x0 + TileSize, width);
+                glm::vec3 lo((x0 - width / 2.0f) * sx, minY, tileMin[ty * tilesX + tx] * zScale);
+                glm::vec3 hi((x1 - 1 - width / 2.0f) * sx, maxY, tileMax[ty * tilesX + tx] * zScale);
+                if (lo.z > hi.z) std::swap(lo.z, hi.z);
+                visible[tx] = boxInFrustum(planes, lo, hi);
+                ranges.visibleTiles += visible[tx];
+            }
+
+            for (uint32_t tx = 0; tx < tilesX;) {
+                if (!visible[tx]) { tx++; continue; }
+                uint32_t runStart = tx;
+                while (tx < tilesX && visible[tx]) tx++;
+                uint32_t x0 = runStart * TileSize;
+                uint32_t x1 = std::min(tx * TileSize, width);
+                for (uint32_t y = y0; y < y1; y++) {
+                    ranges.firsts.push_back(static_cast<int>(static_cast<size_t>(y) * width + x0));
+                    ranges.counts.push_back(static_cast<int>(x1 - x0));
+                }
+                ranges.points += static_cast<size_t>(x1 - x0) * (y1 - y0);
+            }
+        }
+        ranges.all = ranges.visibleTiles == tileCount();
+    }
+
+private:
+    uint32_t width = 0, height = 0;
+    uint32_t tilesX = 0, tilesY = 0;
+    std::vector<float> tileMin, tileMax;
+
+    // Bounds of tiles [tx0, tx1) x [ty0, ty1), from every sample they cover
+    template <typename RowFn>
+    void computeTiles(uint32_t ty0, uint32_t ty1, uint32_t tx0, uint32_t tx1, RowFn fetchRow) {
+        uint32_t w = width, h = height;
+        size_t samples = static_cast<size_t>(ty1 - ty0) * TileSize * (tx1 - tx0) * TileSize;
+        parallelFor(ty1 - ty0, chunkCount(samples), [&](size_t, size_t begin, size_t end) {
+            std::vector<float> scratch(w);
+            for (size_t ty = ty0 + begin; ty < ty0 + end; ty++) {
+                for (uint32_t tx = tx0; tx < tx1; tx++) {
+                    tileMin[ty * tilesX + tx] = std::numeric_limits<float>::max();
+                    tileMax[ty * tilesX + tx] = std::numeric_limits<float>::lowest();
+                }
+                size_t y0 = ty * TileSize;
+                size_t y1 = std::min<size_t>(y0 + TileSize, h);
+                for (size_t y = y0; y < y1; y++) {
+                    const float* loRow;
+                    const float* hiRow;
+                    fetchRow(static_cast<uint32_t>(y), scratch.data(), loRow, hiRow);
+                    for (uint32_t tx = tx0; tx < tx1; tx++) {
+                        size_t x0 = static_cast<size_t>(tx) * TileSize;
+                        size_t x1 = std::min<size_t>(x0 + TileSize, w);
+                        float mn = tileMin[ty * tilesX + tx];
+                        float mx = tileMax[ty * tilesX + tx];
+                        for (size_t x = x0; x < x1; x++) {
+                            mn = std::min(mn, loRow[x]);
+                            mx = std::max(mx, hiRow[x]);
+                        }
+                        tileMin[ty * tilesX + tx] = mn;
+                        tileMax[ty * tilesX + tx] = mx;
+                    }
+                }
+            }
+        });
+    }
+
+    static bool boxInFrustum(const glm::vec4* planes, const glm::vec3& lo, const glm::vec3& hi) {
+        for (int i = 0; i < 6; i++) {
+            const glm::vec4& p = planes[i];
+            // Corner furthest along the plane normal
+            float x = p.x > 0 ? hi.x : lo.x;
+            float y = p.y > 0 ? hi.y : lo.y;
+            float z = p.z > 0 ? hi.z : lo.z;
+            if (p.x * x + p.y * y + p.z * z + p.w < 0) return false;
+        }
+        return true;
+    }
+};
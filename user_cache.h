@@ -0,0 +1,49 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Per-user cache directory for files the viewer normally keeps beside the scans
+// (folder index, scan cache files). It is used when the scan folder is not
+// writable, such as a folder mounted read-only into the container.
+class UserCache {
+public:
+    // $XDG_CACHE_HOME/scan_viewer, falling back to ~/.cache/scan_viewer; the
+    // directories are created on demand
+    static std::string directory() {
+        std::string cache;
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME")) cache = xdg;
+        if (cache.empty()) {
+            const char* home = std::getenv("HOME");
+            cache = std::string(home ? home : "/tmp") + "/.cache";
+        }
+        mkdir(cache.c_str(), 0755);
+        cache += "/scan_viewer";
+        mkdir(cache.c_str(), 0755);
+        return cache;
+    }
+
+    // File in directory() named after the FNV-1a hash of path's absolute form,
+    // followed by suffix
+    static std::string pathFor(const std::string& path, const std::string& suffix) {
+        char resolved[PATH_MAX];
+        std::string key = realpath(path.c_str(), resolved) ? resolved : path;
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key) hash = (hash ^ c) * 1099511628211ull;
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+        return directory() + "/" + name + suffix;
+    }
+
+    // Whether files can be created in the folder holding path
+    static bool besideWritable(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        std::string folder = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        return access(folder.c_str(), W_OK) == 0;
+    }
+};